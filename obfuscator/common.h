@@ -1,12 +1,15 @@
 #ifndef MY_COMMON_H
 #define MY_COMMON_H
 
+#include <cstdint>
 #include <string>
 #include <ostream>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <stack>
 #include <deque>
 #include <set>
@@ -147,13 +150,21 @@ struct Token {
     type(type0),val(val0),loc(loc0),deref(false) {}
 };
 
-//作用域, 为空是全局作用域
+//作用域id, 指向Obfuscator中作用域树的节点
+typedef uint32_t ScopeID;
+const static ScopeID ROOT_SCOPE = 0;
+
+//类型id, 指向TypePool中唯一的类型节点, 可以直接用整数比较
+typedef uint32_t TypeRef;
+const static TypeRef TYPE_OTHER = 0;//解析失败的类型(CPP_OTHER)
+
+//作用域树的节点, 为空是全局作用域
 struct Scope {
     std::string name;
     std::string key;
     int type;//0 namespace 1 class/stuct 3 function
-    std::stack<Token> sb;// store brace to check scope
-    std::deque<Scope> father;
+    int depth;//括号深度, 遍历的时候用来判断作用域的结束
+    ScopeID father;//父作用域, 根节点指向自己
 };
 
 struct ClassType {
@@ -161,8 +172,8 @@ struct ClassType {
     bool is_struct;
     bool is_template;
     std::string father;//不考虑多重继承
-    Scope scope;
-    std::map<std::string, Token> tm_paras;//模板参数
+    ScopeID scope;
+    std::map<std::string, TypeRef> tm_paras;//模板参数
     std::vector<std::string> tm_paras_list;
 };
 
@@ -171,26 +182,46 @@ struct ClassFunction {
     std::string c_name;
     std::string fn_name;//function name
     std::deque<Token> rets;//origin return tokens
-    Token ret;//return token
+    TypeRef ret;//return type
     bool is_virtual;
 };
 
 struct Variable {
     std::string name;
-    Token type;
-    Scope scope;
+    TypeRef type;
+    ScopeID scope;
 };
 
 struct ClassVariable {
     std::string c_name;
     std::string m_name;//member name
-    Token type;
+    TypeRef type;
 };
 
 struct Function {
     std::string name;
-    Token ret;
-    Scope scope;
+    TypeRef ret;
+    ScopeID scope;
+};
+
+//函数定义, 位置是函数体{ }在token流中的下标
+struct FnBody {
+    std::string name;
+    std::string class_name;//成员函数的class, 全局函数为空
+    std::map<std::string, TypeRef> paras;//参数表
+    int begin;
+    int end;
+};
+
+//函数体内的局部声明, 位置是相对函数体{的偏移
+struct LocalDecl {
+    int pos;//可能声明变量的位置
+    int end;//所在块的}的位置, 之后不可见
+};
+
+//函数体的局部声明索引 <名称, 按位置排序的声明>
+struct LocalDeclIndex {
+    std::unordered_map<std::string, std::vector<LocalDecl>> decls;
 };
 
 //由namespace 或者 struct/class中定义， 用作容器分析
@@ -202,6 +233,8 @@ struct ScopeType {
 
 const static std::string ANONYMOUS_SCOPE = "0anonymous_scope0";
 const static std::string THIRD_CLASS = "3th";
+const static int DEFAULT_INFER_BUDGET = 20000;//每个函数体推导主语类型的步数上限
+const static int MAX_INFER_DEPTH = 256;//括号/数组/auto中嵌套推导的最大深度, 超过后用完这个函数体的预算
 
 inline std::ostream& operator << (std::ostream& out, const TokenType& t) {
     switch(t) {
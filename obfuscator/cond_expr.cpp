@@ -0,0 +1,328 @@
+#include "cond_expr.h"
+#include <cstdlib>
+
+//展开后的表达式最多的token数和宏嵌套深度, 超过就判为不能求值
+const static size_t MAX_EXPAND_TOKEN = 4096;
+const static int MAX_EXPAND_DEPTH = 32;
+
+static inline Token number_token(int64_t v) {
+    return {CPP_NUMBER, v != 0 ? "1" : "0", -1};
+}
+
+static inline bool is_name(const Token& t) {
+    return t.type == CPP_NAME || t.type == CPP_MACRO || t.type == CPP_TYPE ||
+        t.type == CPP_KEYWORD || t.type == CPP_ENUM;
+}
+
+static inline bool is_skip(const Token& t) {
+    return t.type == CPP_COMMENT || t.type == CPP_BR || t.type == CPP_CONNECTOR;
+}
+
+//函数宏: 宏名后面紧跟(
+static inline bool is_function_marco(const Token& m) {
+    return m.ts.size() > 1 && m.ts[1].type == CPP_OPEN_PAREN &&
+        m.ts[1].loc == m.ts[0].loc + (int)m.ts[0].val.size();
+}
+
+//整数字面量, 支持0x 0b 八进制 和u/l后缀
+static bool parse_number(const std::string& str, int64_t& v) {
+    std::string s = str;
+    while (!s.empty() && (s.back() == 'u' || s.back() == 'U' || s.back() == 'l' || s.back() == 'L')) {
+        s.pop_back();
+    }
+    if (s.empty()) {
+        return false;
+    }
+    int base = 0;
+    size_t begin = 0;
+    if (s.size() > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) {
+        base = 2;
+        begin = 2;
+    }
+    const char* c_begin = s.c_str() + begin;
+    char* c_end = nullptr;
+    v = (int64_t)strtoull(c_begin, &c_end, base);
+    return c_end != c_begin && *c_end == '\0';
+}
+
+//二元运算符的优先级, 不是二元运算符返回0
+static inline int binary_prec(int type) {
+    switch (type) {
+    case CPP_OR_OR:
+        return 1;
+    case CPP_AND_AND:
+        return 2;
+    case CPP_OR:
+        return 3;
+    case CPP_XOR:
+        return 4;
+    case CPP_AND:
+        return 5;
+    case CPP_EQ_EQ:
+    case CPP_NOT_EQ:
+        return 6;
+    case CPP_LESS:
+    case CPP_GREATER:
+    case CPP_LESS_EQ:
+    case CPP_GREATER_EQ:
+    case CPP_OPEN_ANGLE:
+    case CPP_CLOSE_ANGLE:
+        return 7;
+    case CPP_LSHIFT:
+    case CPP_RSHIFT:
+        return 8;
+    case CPP_PLUS:
+    case CPP_MINUS:
+        return 9;
+    case CPP_MULT:
+    case CPP_DIV:
+    case CPP_MOD:
+        return 10;
+    default:
+        return 0;
+    }
+}
+
+static bool apply_binary(int type, int64_t l, int64_t r, int64_t& v) {
+    switch (type) {
+    case CPP_OR_OR: v = l || r; break;
+    case CPP_AND_AND: v = l && r; break;
+    case CPP_OR: v = l | r; break;
+    case CPP_XOR: v = l ^ r; break;
+    case CPP_AND: v = l & r; break;
+    case CPP_EQ_EQ: v = l == r; break;
+    case CPP_NOT_EQ: v = l != r; break;
+    case CPP_LESS:
+    case CPP_OPEN_ANGLE: v = l < r; break;
+    case CPP_GREATER:
+    case CPP_CLOSE_ANGLE: v = l > r; break;
+    case CPP_LESS_EQ: v = l <= r; break;
+    case CPP_GREATER_EQ: v = l >= r; break;
+    case CPP_LSHIFT:
+        if (r < 0 || r > 63) {
+            return false;
+        }
+        v = (int64_t)((uint64_t)l << r);
+        break;
+    case CPP_RSHIFT:
+        if (r < 0 || r > 63) {
+            return false;
+        }
+        v = l >> r;
+        break;
+    case CPP_PLUS: v = (int64_t)((uint64_t)l + (uint64_t)r); break;
+    case CPP_MINUS: v = (int64_t)((uint64_t)l - (uint64_t)r); break;
+    case CPP_MULT: v = (int64_t)((uint64_t)l * (uint64_t)r); break;
+    case CPP_DIV:
+    case CPP_MOD:
+        if (r == 0 || (l == INT64_MIN && r == -1)) {
+            return false;
+        }
+        v = type == CPP_DIV ? l / r : l % r;
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+CondExpr::CondExpr(const MacroLookup& lookup):_lookup(lookup),_pos(0) {
+
+}
+
+CondExpr::~CondExpr() {
+
+}
+
+int CondExpr::eval(const std::deque<Token>& ts) {
+    _ts.clear();
+    _expanding.clear();
+    _pos = 0;
+    if (!expand(ts, 0, 0) || _ts.empty()) {
+        return -1;
+    }
+
+    int64_t v = 0;
+    if (!parse_cond(v) || _pos != _ts.size()) {
+        return -1;
+    }
+    return v != 0 ? 1 : 0;
+}
+
+bool CondExpr::expand(const std::deque<Token>& ts, size_t begin, int depth) {
+    if (depth > MAX_EXPAND_DEPTH) {
+        return false;
+    }
+
+    for (size_t i = begin; i < ts.size(); ++i) {
+        const Token& t = ts[i];
+        if (_ts.size() > MAX_EXPAND_TOKEN) {
+            return false;
+        }
+        if (is_skip(t)) {
+            continue;
+        }
+        if (t.type == CPP_NUMBER || binary_prec(t.type) > 0 ||
+            t.type == CPP_NOT || t.type == CPP_COMPL || t.type == CPP_QUERY || t.type == CPP_COLON ||
+            t.type == CPP_OPEN_PAREN || t.type == CPP_CLOSE_PAREN) {
+            _ts.push_back(t);
+            continue;
+        }
+        if (!is_name(t)) {
+            //字符, 字符串等不处理
+            return false;
+        }
+
+        if (t.val == "defined") {
+            //defined X 或者 defined(X)
+            size_t j = i+1;
+            bool paren = j < ts.size() && ts[j].type == CPP_OPEN_PAREN;
+            if (paren) {
+                ++j;
+            }
+            if (j >= ts.size() || !is_name(ts[j])) {
+                return false;
+            }
+            Token m;
+            const int found = _lookup(ts[j].val, m);
+            if (found < 0) {
+                //可能是编译选项, 系统头文件或者其他文件里定义的
+                return false;
+            }
+            _ts.push_back(number_token(found));
+            if (paren) {
+                ++j;
+                if (j >= ts.size() || ts[j].type != CPP_CLOSE_PAREN) {
+                    return false;
+                }
+            }
+            i = j;
+            continue;
+        } else if (t.val == "true" || t.val == "false") {
+            _ts.push_back(number_token(t.val == "true"));
+            continue;
+        }
+
+        Token m;
+        if (_expanding.find(t.val) != _expanding.end()) {
+            //自引用的宏是0
+            _ts.push_back(number_token(0));
+            continue;
+        }
+        const int found = _lookup(t.val, m);
+        if (found < 0) {
+            //不确定有没有定义的名字不能判断
+            return false;
+        } else if (found == 0) {
+            //确定没有定义的名字是0
+            _ts.push_back(number_token(0));
+            continue;
+        }
+        if (is_function_marco(m)) {
+            return false;
+        }
+        _expanding.insert(t.val);
+        const size_t size0 = _ts.size();
+        _ts.push_back({CPP_OPEN_PAREN, "(", -1});
+        bool ok = expand(m.ts, 1, depth+1);
+        _ts.push_back({CPP_CLOSE_PAREN, ")", -1});
+        _expanding.erase(t.val);
+        if (!ok) {
+            return false;
+        }
+        if (_ts.size() == size0 + 2) {
+            //空宏
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CondExpr::parse_cond(int64_t& v) {
+    int64_t c = 0;
+    if (!parse_binary(1, c)) {
+        return false;
+    }
+    if (_pos < _ts.size() && _ts[_pos].type == CPP_QUERY) {
+        ++_pos;
+        int64_t l = 0, r = 0;
+        if (!parse_cond(l)) {
+            return false;
+        }
+        if (_pos >= _ts.size() || _ts[_pos].type != CPP_COLON) {
+            return false;
+        }
+        ++_pos;
+        if (!parse_cond(r)) {
+            return false;
+        }
+        v = c ? l : r;
+        return true;
+    }
+    v = c;
+    return true;
+}
+
+bool CondExpr::parse_binary(int prec, int64_t& v) {
+    if (!parse_unary(v)) {
+        return false;
+    }
+    while (_pos < _ts.size()) {
+        const int type = _ts[_pos].type;
+        const int op_prec = binary_prec(type);
+        if (op_prec == 0 || op_prec < prec) {
+            break;
+        }
+        ++_pos;
+        int64_t r = 0;
+        if (!parse_binary(op_prec+1, r)) {
+            return false;
+        }
+        if (!apply_binary(type, v, r, v)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CondExpr::parse_unary(int64_t& v) {
+    if (_pos >= _ts.size()) {
+        return false;
+    }
+    const Token& t = _ts[_pos++];
+    switch (t.type) {
+    case CPP_NOT:
+        if (!parse_unary(v)) {
+            return false;
+        }
+        v = !v;
+        return true;
+    case CPP_COMPL:
+        if (!parse_unary(v)) {
+            return false;
+        }
+        v = ~v;
+        return true;
+    case CPP_MINUS:
+        if (!parse_unary(v)) {
+            return false;
+        }
+        v = (int64_t)(0 - (uint64_t)v);
+        return true;
+    case CPP_PLUS:
+        return parse_unary(v);
+    case CPP_OPEN_PAREN:
+        if (!parse_cond(v)) {
+            return false;
+        }
+        if (_pos >= _ts.size() || _ts[_pos].type != CPP_CLOSE_PAREN) {
+            return false;
+        }
+        ++_pos;
+        return true;
+    case CPP_NUMBER:
+        return parse_number(t.val, v);
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef MY_COND_EXPR_H
+#define MY_COND_EXPR_H
+
+#include "common.h"
+
+//#if/#elif 的常量表达式求值
+//先展开defined和对象宏(函数宏不展开, 直接判为不能求值), 再按C的优先级折叠常量
+//不确定有没有定义的名字(编译选项-D_DEBUG, 系统头文件, 其他文件里的定义)判为不能求值
+class CondExpr {
+public:
+    //宏查找, 1 有定义, val是#define token(ts[0]是宏名, 后面是宏体); 0 确定没有定义; -1 不确定
+    typedef std::function<int(const std::string&, Token&)> MacroLookup;
+
+    explicit CondExpr(const MacroLookup& lookup);
+    ~CondExpr();
+
+    //1 成立, 0 不成立, -1 不能判断
+    int eval(const std::deque<Token>& ts);
+
+private:
+    bool expand(const std::deque<Token>& ts, size_t begin, int depth);
+    bool parse_cond(int64_t& v);
+    bool parse_binary(int prec, int64_t& v);
+    bool parse_unary(int64_t& v);
+
+private:
+    MacroLookup _lookup;
+    std::vector<Token> _ts;//展开后的表达式
+    std::set<std::string> _expanding;//正在展开的宏, 防止自引用
+    size_t _pos;
+};
+
+#endif
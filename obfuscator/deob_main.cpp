@@ -0,0 +1,141 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include "deobfuscator.h"
+#include "source_map.h"
+
+//每个线程每次处理的数据量
+const static size_t BLOCK_SIZE = 16*1024*1024;
+
+//文件用mmap按窗口处理
+static int filter_file(const Deobfuscator& deob, const char* path, int threads) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "open input failed: " << path << "\n";
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    const size_t size = (size_t)st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        std::cerr << "mmap input failed: " << path << "\n";
+        return -1;
+    }
+    madvise(m, size, MADV_SEQUENTIAL);
+
+    const char* data = (const char*)m;
+    const size_t window = BLOCK_SIZE*threads;
+    size_t pos = 0;
+    while (pos < size) {
+        const size_t end = std::min(size, pos+window);
+        size_t n = deob.filter_blocks(data+pos, data+end, end == size, threads, stdout);
+        if (n == 0) {
+            //整个窗口是一个标识符
+            n = deob.filter_blocks(data+pos, data+end, true, 1, stdout);
+        }
+        pos += n;
+    }
+    munmap(m, size);
+    return 0;
+}
+
+//stdin按块读, 没处理完的尾部留到下一次
+static int filter_stdin(const Deobfuscator& deob, int threads) {
+    const size_t window = BLOCK_SIZE*threads;
+    std::vector<char> buf(window);
+    size_t len = 0;
+    while (true) {
+        const size_t n = fread(buf.data()+len, 1, buf.size()-len, stdin);
+        len += n;
+        const bool eof = n == 0;
+        if (len == 0 && eof) {
+            break;
+        }
+        size_t done = deob.filter_blocks(buf.data(), buf.data()+len, eof, threads, stdout);
+        if (done == 0 && len == buf.size()) {
+            done = deob.filter_blocks(buf.data(), buf.data()+len, true, 1, stdout);
+        }
+        memmove(buf.data(), buf.data()+done, len-done);
+        len -= done;
+        if (eof) {
+            break;
+        }
+    }
+    return 0;
+}
+
+//l1d --map <file.l1map> line:col...
+//把混淆后文件里的位置换算成原文件的位置, 每个位置输出一行 line:col
+static int lookup_source_map(int argc, char* argv[]) {
+    SourceMap smap;
+    if (!smap.load(argv[2])) {
+        std::cerr << "load source map failed: " << argv[2] << "\n";
+        return -1;
+    }
+    for (int i = 3; i < argc; ++i) {
+        unsigned int line = 0;
+        unsigned int col = 0;
+        char tail = 0;
+        if (sscanf(argv[i], "%u:%u%c", &line, &col, &tail) != 2) {
+            std::cerr << "invalid position: " << argv[i] << ", should be line:col\n";
+            return -1;
+        }
+        uint32_t orig_line = 0;
+        uint32_t orig_col = 0;
+        smap.lookup(line, col, orig_line, orig_col);
+        std::cout << orig_line << ":" << orig_col << "\n";
+    }
+    return 0;
+}
+
+//l1d <replace_map|mapping_db> [input_file] [threads]
+//没有input_file时从stdin读, 结果写到stdout
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "--map") {
+        if (argc < 4) {
+            std::cerr << "usage: l1d --map <file.l1map> line:col...\n";
+            return -1;
+        }
+        return lookup_source_map(argc, argv);
+    }
+    if (argc < 2) {
+        std::cerr << "usage: l1d <replace_map|mapping_db> [input_file|-] [threads]\n";
+        std::cerr << "       l1d --map <file.l1map> line:col...\n";
+        return -1;
+    }
+
+    Deobfuscator deob;
+    if (0 != deob.load(argv[1])) {
+        return -1;
+    }
+    std::cerr << "load " << deob.size() << " symbols.\n";
+
+    int threads = (int)std::thread::hardware_concurrency();
+    if (argc >= 4) {
+        threads = atoi(argv[3]);
+    }
+    threads = std::max(1, threads);
+
+    int ret = 0;
+    if (argc >= 3 && std::string(argv[2]) != "-") {
+        ret = filter_file(deob, argv[2], threads);
+    } else {
+        ret = filter_stdin(deob, threads);
+    }
+    fflush(stdout);
+    return ret;
+}
@@ -0,0 +1,221 @@
+#include "deobfuscator.h"
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace {
+//标识符字符表, 1 标识符字符, 2 数字
+struct IdentTable {
+    unsigned char v[256];
+    IdentTable() {
+        for (int c = 0; c < 256; ++c) {
+            v[c] = 0;
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+                v[c] = 1;
+            } else if (c >= '0' && c <= '9') {
+                v[c] = 2;
+            }
+        }
+    }
+};
+
+const IdentTable IDENT;
+
+inline bool is_ident(char c) {
+    return IDENT.v[(unsigned char)c] != 0;
+}
+
+//FNV-1a
+inline uint64_t hash_bytes(const char* s, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+//[begin, end)里最后一个可以切分的位置, 切分点之前的内容可以独立还原
+const char* cut_point(const char* begin, const char* end) {
+    for (const char* p = end; p != begin; --p) {
+        if (*(p-1) == '\n') {
+            return p;
+        }
+    }
+    for (const char* p = end; p != begin; --p) {
+        if (!is_ident(*(p-1))) {
+            return p;
+        }
+    }
+    return begin;
+}
+}
+
+Deobfuscator::Deobfuscator():_size(0),_min_len(SIZE_MAX),_max_len(0) {
+    rehash(1024);
+}
+
+Deobfuscator::~Deobfuscator() {
+
+}
+
+int Deobfuscator::load(const std::string& f) {
+    std::ifstream in(f, std::ios::in);
+    if (!in.is_open()) {
+        std::cerr << "open mapping file failed: " << f << "\n";
+        return -1;
+    }
+    std::string line;
+    while(std::getline(in, line)) {
+        if (line == "#mode short") {
+            //短名字(a, B0...)和日志里普通的单词无法区分, 逐词替换会改坏原文
+            std::cerr << "mapping file " << f << " is short mode, its names can not be told from ordinary words.\n"
+                << "obfuscate with 'l1 hash' or 'l1 hash sip' to get a map that l1d can restore.\n";
+            return -1;
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        const size_t tab = line.find('\t');
+        if (tab == std::string::npos || tab == 0 || tab+1 == line.size()) {
+            continue;
+        }
+        insert(line.substr(tab+1), line.substr(0, tab));
+    }
+    in.close();
+
+    return 0;
+}
+
+size_t Deobfuscator::size() const {
+    return _size;
+}
+
+void Deobfuscator::rehash(size_t capacity) {
+    std::vector<Entry> old;
+    old.swap(_table);
+    _table.assign(capacity, Entry{0, 0, 0, 0, 0});
+    const size_t mask = capacity-1;
+    for (auto it = old.begin(); it != old.end(); ++it) {
+        if (it->key_len == 0) {
+            continue;
+        }
+        size_t i = it->hash & mask;
+        while (_table[i].key_len != 0) {
+            i = (i+1) & mask;
+        }
+        _table[i] = *it;
+    }
+}
+
+void Deobfuscator::insert(const std::string& key, const std::string& val) {
+    if (find(key.c_str(), key.size())) {
+        return;
+    }
+    //负载不超过1/2
+    if ((_size+1)*2 > _table.size()) {
+        rehash(_table.size()*2);
+    }
+    Entry e;
+    e.hash = hash_bytes(key.c_str(), key.size());
+    e.key = (uint32_t)_pool.size();
+    e.key_len = (uint32_t)key.size();
+    _pool += key;
+    e.val = (uint32_t)_pool.size();
+    e.val_len = (uint32_t)val.size();
+    _pool += val;
+
+    const size_t mask = _table.size()-1;
+    size_t i = e.hash & mask;
+    while (_table[i].key_len != 0) {
+        i = (i+1) & mask;
+    }
+    _table[i] = e;
+    ++_size;
+    _min_len = std::min(_min_len, key.size());
+    _max_len = std::max(_max_len, key.size());
+}
+
+const Deobfuscator::Entry* Deobfuscator::find(const char* key, size_t len) const {
+    if (len < _min_len || len > _max_len) {
+        return nullptr;
+    }
+    const uint64_t h = hash_bytes(key, len);
+    const size_t mask = _table.size()-1;
+    for (size_t i = h & mask; _table[i].key_len != 0; i = (i+1) & mask) {
+        const Entry& e = _table[i];
+        if (e.hash == h && e.key_len == len && _pool.compare(e.key, len, key, len) == 0) {
+            return &e;
+        }
+    }
+    return nullptr;
+}
+
+void Deobfuscator::filter(const char* begin, const char* end, std::string& out) const {
+    //没有替换的部分整段拷贝
+    const char* copied = begin;
+    const char* p = begin;
+    while (p != end) {
+        if (!is_ident(*p)) {
+            ++p;
+            continue;
+        }
+        const char* id = p;
+        while (p != end && is_ident(*p)) {
+            ++p;
+        }
+        //数字开头的是数字或者mangled名字的长度前缀
+        if (IDENT.v[(unsigned char)*id] == 2) {
+            continue;
+        }
+        const Entry* e = find(id, p-id);
+        if (e) {
+            out.append(copied, id);
+            out.append(_pool, e->val, e->val_len);
+            copied = p;
+        }
+    }
+    out.append(copied, end);
+}
+
+size_t Deobfuscator::filter_blocks(const char* begin, const char* end, bool final, int threads, FILE* out) const {
+    const char* stop = final ? end : cut_point(begin, end);
+    if (stop == begin) {
+        return 0;
+    }
+
+    //按换行分成threads段并行还原, 再按顺序输出
+    threads = std::max(1, threads);
+    std::vector<const char*> cuts(1, begin);
+    const size_t step = (stop-begin) / threads + 1;
+    for (int i = 1; i < threads; ++i) {
+        const char* p = cuts.back() + step;
+        if (p >= stop) {
+            break;
+        }
+        p = cut_point(cuts.back(), p);
+        if (p != cuts.back()) {
+            cuts.push_back(p);
+        }
+    }
+    cuts.push_back(stop);
+
+    std::vector<std::string> outs(cuts.size()-1);
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < outs.size(); ++i) {
+        outs[i].reserve(cuts[i+1]-cuts[i]);
+        workers.push_back(std::thread([this, &cuts, &outs, i]() {
+            filter(cuts[i], cuts[i+1], outs[i]);
+        }));
+    }
+    outs[0].reserve(cuts[1]-cuts[0]);
+    filter(cuts[0], cuts[1], outs[0]);
+    for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+    }
+
+    for (auto it = outs.begin(); it != outs.end(); ++it) {
+        fwrite(it->data(), 1, it->size(), out);
+    }
+    return stop-begin;
+}
@@ -0,0 +1,50 @@
+#ifndef MY_DEOBFUSCATOR_H
+#define MY_DEOBFUSCATOR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//把日志, perf script输出, 调用栈里的混淆名还原成原名
+//按标识符切分输入, 整个标识符在新名字的hash表里查找, 短名字也不会误替换标识符的一部分
+//mangled的符号(_ZN..)整体是一个标识符, 不会替换, 需要先用c++filt还原
+class Deobfuscator {
+public:
+    Deobfuscator();
+    ~Deobfuscator();
+
+    //读取replace_map或mapping_db, 每行 原名\t新名字, #开头的行跳过
+    //short模式(#mode short)的映射返回-1, 短名字和普通单词无法区分
+    int load(const std::string& f);
+    size_t size() const;
+
+    //还原[begin, end)追加到out, 调用方保证区间的两端不在标识符中间
+    void filter(const char* begin, const char* end, std::string& out) const;
+
+    //多线程还原一段输入写到out, final为false时只处理到最后一个换行(没有换行时最后一个非标识符字符)
+    //返回处理的字节数
+    size_t filter_blocks(const char* begin, const char* end, bool final, int threads, FILE* out) const;
+
+private:
+    struct Entry {
+        uint64_t hash;
+        uint32_t key;//新名字在_pool里的偏移
+        uint32_t key_len;
+        uint32_t val;//原名在_pool里的偏移
+        uint32_t val_len;
+    };
+
+    void insert(const std::string& key, const std::string& val);
+    const Entry* find(const char* key, size_t len) const;
+    void rehash(size_t capacity);
+
+private:
+    std::vector<Entry> _table;//开放寻址, 容量是2的幂, key_len为0是空位
+    std::string _pool;
+    size_t _size;
+    size_t _min_len;
+    size_t _max_len;
+};
+
+#endif
@@ -439,6 +439,203 @@ static inline Token lex_string(char c , Reader* cpp_reader, Token& token, int pe
     }
 }
 
+BracketIndex::BracketIndex():_gen(0) {
+
+}
+
+enum BracketKind {
+    BRACKET_NONE = -1,
+    BRACKET_BRACE = 0,
+    BRACKET_PAREN,
+    BRACKET_SQUARE,
+    BRACKET_ANGLE,
+    BRACKET_KIND_NUM,
+};
+
+//返回括号的种类, open表示是否是开括号
+static inline int bracket_kind(int type, bool& open) {
+    switch (type) {
+    case CPP_OPEN_BRACE:
+    case CPP_CLASS_BEGIN:
+        open = true;
+        return BRACKET_BRACE;
+    case CPP_CLOSE_BRACE:
+    case CPP_CLASS_END:
+        open = false;
+        return BRACKET_BRACE;
+    case CPP_OPEN_PAREN:
+        open = true;
+        return BRACKET_PAREN;
+    case CPP_CLOSE_PAREN:
+        open = false;
+        return BRACKET_PAREN;
+    case CPP_OPEN_SQUARE:
+        open = true;
+        return BRACKET_SQUARE;
+    case CPP_CLOSE_SQUARE:
+        open = false;
+        return BRACKET_SQUARE;
+    case CPP_LESS:
+        open = true;
+        return BRACKET_ANGLE;
+    case CPP_GREATER:
+        open = false;
+        return BRACKET_ANGLE;
+    default:
+        return BRACKET_NONE;
+    }
+}
+
+void BracketIndex::build(const std::deque<Token>& ts, uint64_t gen) {
+    _gen = gen;
+    const size_t size = ts.size();
+    _pair.assign(size, -1);
+
+    //<>可能是小于大于号, 遇到;就丢弃未配对的<>, 交给跳转函数逐个扫描
+    std::vector<int> st[BRACKET_KIND_NUM];
+    for (size_t i = 0; i < size; ++i) {
+        bool open = false;
+        const int kind = bracket_kind(ts[i].type, open);
+        if (kind == BRACKET_NONE) {
+            if (ts[i].type == CPP_SEMICOLON) {
+                st[BRACKET_ANGLE].clear();
+            }
+            continue;
+        }
+        if (open) {
+            st[kind].push_back(i);
+        } else if (!st[kind].empty()) {
+            _pair[st[kind].back()] = i;
+            st[kind].pop_back();
+        }
+    }
+
+    for (int k = 0; k < BRACKET_KIND_NUM; ++k) {
+        st[k].clear();
+    }
+    for (int i = (int)size - 1; i >= 0; --i) {
+        bool open = false;
+        const int kind = bracket_kind(ts[i].type, open);
+        if (kind == BRACKET_NONE) {
+            if (ts[i].type == CPP_SEMICOLON) {
+                st[BRACKET_ANGLE].clear();
+            }
+            continue;
+        }
+        if (!open) {
+            st[kind].push_back(i);
+        } else if (!st[kind].empty()) {
+            _pair[st[kind].back()] = i;
+            st[kind].pop_back();
+        }
+    }
+}
+
+bool BracketIndex::is_stale(uint64_t gen) const {
+    return _gen != gen;
+}
+
+int BracketIndex::pair(size_t pos) const {
+    return pos < _pair.size() ? _pair[pos] : -1;
+}
+
+bool BracketIndex::is_pair(int open_type, int close_type) {
+    bool open = false;
+    bool close = true;
+    const int kind = bracket_kind(open_type, open);
+    return kind != BRACKET_NONE && open && kind == bracket_kind(close_type, close) && !close;
+}
+
+//修改计数从1开始, 0表示没有建过的索引
+static uint64_t s_token_gen = 0;
+
+TokenStream::TokenStream():_gen(++s_token_gen) {
+
+}
+
+TokenStream& TokenStream::operator=(const Base& ts) {
+    touch();
+    Base::operator=(ts);
+    return *this;
+}
+
+void TokenStream::erase_ranges(const std::vector<std::pair<int, int>>& ranges) {
+    if (ranges.empty()) {
+        return;
+    }
+    touch();
+    Base& ts = *this;
+    int w = ranges[0].first;
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        const int next = r+1 < ranges.size() ? ranges[r+1].first : (int)ts.size();
+        for (int i = ranges[r].second; i < next; ++i) {
+            ts[w++] = std::move(ts[i]);
+        }
+    }
+    Base::erase(ts.begin() + w, ts.end());
+}
+
+void TokenStream::touch() {
+    _gen = ++s_token_gen;
+}
+
+const BracketIndex& TokenStream::brackets() const {
+    if (_brackets.is_stale(_gen)) {
+        _brackets.build(tokens(), _gen);
+    }
+    return _brackets;
+}
+
+CondIndex::CondIndex():_gen(0) {
+
+}
+
+void CondIndex::build(const TokenStream& ts) {
+    _gen = ts.gen();
+    const size_t size = ts.size();
+    _branch.assign(size, -1);
+    _branches.clear();
+
+    //每组#if...#endif的最后一个分支
+    std::vector<int> st;
+    const int t_end = (int)size - TOKEN_PAD;
+    for (int i = TOKEN_PAD; i < t_end; ++i) {
+        const Token& t = ts[i];
+        if (t.type != CPP_PREPROCESSOR) {
+            continue;
+        }
+        if (t.val == "if" || t.val == "ifdef" || t.val == "ifndef") {
+            _branch[i] = _branches.size();
+            st.push_back(_branches.size());
+            _branches.push_back({i, t_end, true});
+        } else if ((t.val == "elif" || t.val == "else") && !st.empty()) {
+            _branches[st.back()].end = i;
+            _branch[i] = _branches.size();
+            st.back() = _branches.size();
+            _branches.push_back({i, t_end, true});
+        } else if (t.val == "endif" && !st.empty()) {
+            _branches[st.back()].end = i;
+            st.pop_back();
+        }
+    }
+}
+
+bool CondIndex::is_stale(const TokenStream& ts) const {
+    return _gen != ts.gen();
+}
+
+int CondIndex::branch(size_t pos) const {
+    return pos < _branch.size() ? _branch[pos] : -1;
+}
+
+CondBranch& CondIndex::get(int idx) {
+    return _branches[idx];
+}
+
+size_t CondIndex::size() const {
+    return _branches.size();
+}
+
 Lex::Lex() {
 
 }
@@ -451,10 +648,29 @@ void Lex::set_reader(Reader* reader) {
     _reader = reader;
 }
 
+void Lex::seal_token() {
+    //文件读完后首尾加上哨兵, 之后只能在哨兵之间增删token
+    for (int i = 0; i < TOKEN_PAD; ++i) {
+        _ts.push_front({CPP_EOF,"",-1});
+        _ts.push_back({CPP_EOF,"",-1});
+    }
+}
+
 void Lex::stage_token() {
     _stage_ts = _ts;
 }
 
+CondIndex& Lex::conditions() {
+    if (_conds.is_stale(_ts)) {
+        _conds.build(_ts);
+    }
+    return _conds;
+}
+
+const BracketIndex& Lex::brackets() {
+    return _ts.brackets();
+}
+
 Token Lex::lex(Reader* cpp_reader) {
     if (cpp_reader->eof()) {
         return {CPP_EOF,"",0};
@@ -794,52 +1010,64 @@ static inline bool is_type(const std::string& str) {
     return false;
 } 
 
+bool Lex::is_reserved(const std::string& name) {
+    for (size_t i=0; i<sizeof(keywords)/sizeof(char*); ++i) {
+        if (name == keywords[i]) {
+            return true;
+        }
+    }
+    return is_type(name);
+}
+
+//记下要删除的[pos, pos+n), 和上一段相连时合并
+static void drop_token(std::vector<std::pair<int, int>>& drop, int pos, int n) {
+    if (!drop.empty() && drop.back().second == pos) {
+        drop.back().second += n;
+    } else {
+        drop.push_back(std::make_pair(pos, pos+n));
+    }
+}
+
 void Lex::l1() {
-    for (auto t = _ts.begin(); t != _ts.end(); ) {
+    //删除的token先记下位置, 最后一次删掉, 相邻的记录合并, 前一个保留的token跳过最后一段
+    std::vector<std::pair<int, int>> drop;
+    for (auto t = token_begin(_ts); t != token_end(_ts); ) {
+        const int pos = t - _ts.begin();
         //number sign
         if (t->type == CPP_PLUS || t->type == CPP_MINUS) {
             std::string sign = t->type == CPP_PLUS ? "+" : "-";
-            if (t == _ts.begin()) {
-                auto t_n = t+1;
-                if (t_n != _ts.end() && t_n->type==CPP_NUMBER) {
-                    t_n->val = sign + t_n->val;
-                    t_n->loc = t->loc;
-                    t = _ts.erase(t);
-                    continue;
-                }
-            } else {
-                auto t_n = t+1;
-                auto t_p = t-1;
-                if (t_n != _ts.end() && t_n->type==CPP_NUMBER && t_p->type != CPP_NUMBER) {
-                    t_n->val = sign + t_n->val;
-                    t_n->loc = t->loc;
-                    t = _ts.erase(t);
-                    continue;
-                }
+            auto t_n = t+1;
+            auto t_p = (!drop.empty() && drop.back().second == pos) ? _ts.begin() + drop.back().first - 1 : t-1;
+            if (t_n->type==CPP_NUMBER && t_p->type != CPP_NUMBER) {
+                t_n->val = sign + t_n->val;
+                t_n->loc = t->loc;
+                drop_token(drop, pos, 1);
+                ++t;
+                continue;
             }
         }
 
         if (t->type == CPP_PASTE) {
             auto t_n = t+1;
             //include header
-            if (t_n != _ts.end() && t_n->type == CPP_NAME && t_n->val == "include") {
+            if (t_n->type == CPP_NAME && t_n->val == "include") {
                 auto t_nn = t_n+1;
-                if (t_nn != _ts.end() && t_nn->type == CPP_STRING) {
+                if (t_nn->type == CPP_STRING) {
                     //#include "***"
                     t_nn->type = CPP_HEADER_NAME;
                     t_nn->val = t_nn->val.substr(1,t_nn->val.length()-2);
                     t_nn->loc = t->loc;
-                    t = _ts.erase(t);
-                    t = _ts.erase(t);
+                    drop_token(drop, pos, 2);
+                    t = t_nn;
                     continue;
-                } else if (t_nn != _ts.end() && t_nn->type == CPP_LESS) {
+                } else if (t_nn->type == CPP_LESS) {
                     //#include <***>
                     //get >
                     auto t_nnn = t_n+2;
                     std::string include_str;
                     int num_l = 0;
                     bool got = false;
-                    while (t_nnn != _ts.end() && !got) {
+                    while (t_nnn != token_end(_ts) && !got) {
                         if (t_nnn->type != CPP_GREATER) {
                             include_str += t_nnn->val;
                             ++num_l;
@@ -853,45 +1081,44 @@ void Lex::l1() {
                         t_nnn->type = CPP_HEADER_NAME;
                         t_nnn->val = include_str;
                         t_nnn->loc = t->loc;
-                        t = _ts.erase(t);//#
-                        t = _ts.erase(t);//include
-                        t = _ts.erase(t);//*.h
-                        while(num_l > 0) {
-                            t = _ts.erase(t);
-                            --num_l;
-                        }
+                        //# include < *.h
+                        drop_token(drop, pos, 3+num_l);
+                        t = t_nnn;
                         continue;
                     }                  
                 }
             } 
             //preprocess
-            else if (t_n != _ts.end() && (t_n->type==CPP_NAME || t_n->type==CPP_KEYWORD)) {
+            else if (t_n->type==CPP_NAME || t_n->type==CPP_KEYWORD) {
                 if (t_n->val == "define" || t_n->val == "if" || t_n->val == "elif" || 
                     t_n->val == "else" || t_n->val == "ifndef" || t_n->val == "ifdef" ||
                     t_n->val == "pragma" || t_n->val == "error" || 
                     t_n->val == "undef" || t_n->val == "line") {
-                    t->val = t_n->val;
-                    t->type = CPP_PREPROCESSOR;
+                    Token& pp = *t;
+                    pp.val = t_n->val;
+                    pp.type = CPP_PREPROCESSOR;
+                    ++t;
+                    drop_token(drop, t - _ts.begin(), 1);//erase properssor
                     ++t;
-                    t = _ts.erase(t);//erase properssor
                     while(t->type != CPP_EOF) {
                         if (t->type == CPP_CONNECTOR && (t+1)->type == CPP_BR) {
                             //erase connector and br
-                            t = _ts.erase(t);
-                            t = _ts.erase(t);
+                            drop_token(drop, t - _ts.begin(), 2);
+                            t += 2;
                         } else if (t->type == CPP_BR) {
                             break;
                         } else {
-                            (t-1)->ts.push_back(*t);
-                            t = _ts.erase(t);
+                            pp.ts.push_back(*t);
+                            drop_token(drop, t - _ts.begin(), 1);
+                            ++t;
                         }
                     }
                     continue;
                 } else if (t_n->val == "endif") {
                     t->val = t_n->val;
                     t->type = CPP_PREPROCESSOR;
-                    ++t;
-                    t = _ts.erase(t);//erase properssor
+                    drop_token(drop, pos+1, 1);//erase properssor
+                    t += 2;
                     continue;
                 }
 
@@ -918,33 +1145,34 @@ void Lex::l1() {
 
         ++t;
     }
+    _ts.erase_ranges(drop);
 }
 
 void Lex::l2() { 
-    for (auto t = _ts.begin(); t != _ts.end(); ) {
+    //删除的token先记下位置, 最后一次删掉
+    std::vector<std::pair<int, int>> drop;
+    for (auto t = token_begin(_ts); t != token_end(_ts); ) {
         //conbine type
         if (t->type == CPP_TYPE) {
             auto t_n = t+1;
-            while(t_n!=_ts.end() && t_n->type == CPP_TYPE) {
+            while(t_n->type == CPP_TYPE) {
                 t_n->val = t->val + " " + t_n->val;
-                t = _ts.erase(t);
+                drop_token(drop, t - _ts.begin(), 1);
+                t = t_n;
                 t_n = t+1;
             }
             ++t;
             continue;
         }
         //erase br
-        if (t->type == CPP_BR) {
-            t = _ts.erase(t);
-            continue;
-        }
-
         //erase connector
-        if (t->type == CPP_CONNECTOR) {
-            t = _ts.erase(t);
+        if (t->type == CPP_BR || t->type == CPP_CONNECTOR) {
+            drop_token(drop, t - _ts.begin(), 1);
+            ++t;
             continue;
         }
 
         ++t;
     }
+    _ts.erase_ranges(drop);
 }
\ No newline at end of file
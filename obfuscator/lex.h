@@ -27,18 +27,195 @@ public:
     void skip_white();
 };
 
+//括号配对表, 下标是token在流中的位置, 值是配对括号的位置(没有配对为-1)
+//开括号的配对按正向计数得到, 闭括号的配对按反向计数得到, 和逐个token计数跳转的结果一致
+class BracketIndex {
+public:
+    BracketIndex();
+
+    void build(const std::deque<Token>& ts, uint64_t gen);
+    bool is_stale(uint64_t gen) const;
+    int pair(size_t pos) const;
+    //两个type是否还是同一种括号的一开一闭
+    static bool is_pair(int open_type, int close_type);
+
+private:
+    std::vector<int> _pair;
+    uint64_t _gen;//建表时流的修改计数, 流被增删后表失效
+};
+
+//带修改计数的token流, 增删token和整体赋值都会更新计数, 依赖位置的索引按计数判断是否失效
+//计数全局递增, 不同的流/拷贝之间不会重复; 拷贝的流内容相同, 索引跟着拷贝仍然有效
+//改token的type时不能改变括号的种类(如{改成CPP_CLASS_BEGIN可以), 查表时会再核对两端的括号
+//私有继承deque, 不能当作std::deque<Token>&修改(绕过计数会让索引过期), 只读时用tokens()
+//一趟里要删很多token时先记下位置, 最后用erase_ranges一次删掉, 避免每删一个就整体移动一次
+class TokenStream : private std::deque<Token> {
+public:
+    typedef std::deque<Token> Base;
+    using Base::iterator;
+    using Base::const_iterator;
+    using Base::value_type;
+    using Base::reference;
+    using Base::const_reference;
+    using Base::size_type;
+    using Base::begin;
+    using Base::end;
+    using Base::cbegin;
+    using Base::cend;
+    using Base::size;
+    using Base::empty;
+    using Base::operator[];
+    using Base::front;
+    using Base::back;
+
+    TokenStream();
+    TokenStream& operator=(const Base& ts);
+
+    uint64_t gen() const {
+        return _gen;
+    }
+
+    const Base& tokens() const {
+        return *this;
+    }
+
+    iterator erase(iterator pos) {
+        touch();
+        return Base::erase(pos);
+    }
+    iterator erase(iterator first, iterator last) {
+        touch();
+        return Base::erase(first, last);
+    }
+    //删除多段[first, second), 按位置递增且不重叠, 保留的token只移动一次
+    void erase_ranges(const std::vector<std::pair<int, int>>& ranges);
+    iterator insert(iterator pos, const Token& t) {
+        touch();
+        return Base::insert(pos, t);
+    }
+    template <typename It>
+    void insert(iterator pos, It first, It last) {
+        touch();
+        Base::insert(pos, first, last);
+    }
+    void push_back(const Token& t) {
+        touch();
+        Base::push_back(t);
+    }
+    void push_front(const Token& t) {
+        touch();
+        Base::push_front(t);
+    }
+    void pop_back() {
+        touch();
+        Base::pop_back();
+    }
+    void pop_front() {
+        touch();
+        Base::pop_front();
+    }
+    void clear() {
+        touch();
+        Base::clear();
+    }
+    void swap(Base& ts) {
+        touch();
+        Base::swap(ts);
+    }
+
+    //当前内容的括号配对表, 失效时重建
+    const BracketIndex& brackets() const;
+
+private:
+    void touch();
+
+private:
+    uint64_t _gen;
+    mutable BracketIndex _brackets;
+};
+
+//每个文件的token流(Lex::_ts, Lex::_stage_ts)首尾各有TOKEN_PAD个CPP_EOF哨兵(seal_token加上),
+//有效token在[token_begin(ts), token_end(ts))之间, 从有效token向前/向后看TOKEN_PAD个token都不会越界.
+//哨兵的type是CPP_EOF, val为空, 不会被任何类型/名称判断匹配到, 各阶段也不能删除它们.
+//typedef, 宏等嵌套的token流(Token::ts)没有哨兵
+const static int TOKEN_PAD = 4;
+
+inline std::deque<Token>::iterator token_begin(std::deque<Token>& ts) {
+    return ts.begin() + TOKEN_PAD;
+}
+
+inline std::deque<Token>::iterator token_end(std::deque<Token>& ts) {
+    return ts.end() - TOKEN_PAD;
+}
+
+inline std::deque<Token>::const_iterator token_begin(const std::deque<Token>& ts) {
+    return ts.begin() + TOKEN_PAD;
+}
+
+inline std::deque<Token>::const_iterator token_end(const std::deque<Token>& ts) {
+    return ts.end() - TOKEN_PAD;
+}
+
+inline TokenStream::iterator token_begin(TokenStream& ts) {
+    return ts.begin() + TOKEN_PAD;
+}
+
+inline TokenStream::iterator token_end(TokenStream& ts) {
+    return ts.end() - TOKEN_PAD;
+}
+
+inline TokenStream::const_iterator token_begin(const TokenStream& ts) {
+    return ts.begin() + TOKEN_PAD;
+}
+
+inline TokenStream::const_iterator token_end(const TokenStream& ts) {
+    return ts.end() - TOKEN_PAD;
+}
+
+//预处理条件分支: #if/#ifdef/#ifndef/#elif/#else 到同组下一个条件指令(#elif/#else/#endif)之间
+struct CondBranch {
+    int begin;//条件指令在流中的位置
+    int end;//同组下一个条件指令的位置, 没有#endif时是最后一个哨兵之前
+    bool active;//是否会被编译, 默认都走, 由宏定义决定
+};
+
+//条件分支索引, 下标是条件指令在流中的位置, 值是这条指令开始的分支(#endif和普通token为-1)
+//只能建在带哨兵的文件token流上
+class CondIndex {
+public:
+    CondIndex();
+
+    void build(const TokenStream& ts);
+    bool is_stale(const TokenStream& ts) const;
+    int branch(size_t pos) const;
+    CondBranch& get(int idx);
+    size_t size() const;
+
+private:
+    std::vector<CondBranch> _branches;
+    std::vector<int> _branch;
+    uint64_t _gen;//建表时流的修改计数, 流被增删后表失效
+};
+
 class Lex {
 public:
-    std::deque<Token> _ts;
-    std::deque<Token> _stage_ts;
+    TokenStream _ts;
+    TokenStream _stage_ts;
     Reader* _reader;
+    CondIndex _conds;
 
 public:
     Lex();
     ~Lex();
 
     void set_reader(Reader* reader);
+    void seal_token();
     void stage_token();
+    const BracketIndex& brackets();
+    CondIndex& conditions();
+
+    //关键字或者内置类型名
+    static bool is_reserved(const std::string& name);
 
     Token lex(Reader* cpp_reader);
     void push_token(const Token& t);
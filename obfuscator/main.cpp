@@ -1,8 +1,16 @@
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 #include "obfuscator.h"
 #include "util.h"
 
-Obfuscator obfuscator;
+//词法分析一次的文件, 每个宏配置共用
+struct LexFile {
+    std::string name;
+    std::string path;
+    std::string out_path;
+    Lex* lex;
+    Reader* reader;
+};
 
 static int get_source_files(std::vector<std::string>& files) {
     std::ifstream in("./file_source", std::ios::in);
@@ -103,12 +111,232 @@ static int get_ignore_class_function_name(std::map<std::string,std::set<std::str
     return 0;
 }
 
+//可选配置, 每个函数体推导主语类型的步数上限
+static int get_infer_budget(int& budget) {
+    std::ifstream in("./infer_budget", std::ios::in);
+    if (!in.is_open()) {
+        return 0;
+    }
+    std::string line;
+    while(std::getline(in, line)) {
+        if (!line.empty() && line[0] != '#') {
+            budget = atoi(line.c_str());
+            break;
+        }
+    }
+
+    in.close();
+
+    return 0;
+}
+
+//可选配置, 每行一个宏配置, 空格分隔的 NAME 或 NAME=VALUE 当作预定义宏, 只有 - 的行是不加宏的配置
+//没有配置文件时只按源码里的宏分析一次
+static int get_marco_configs(std::vector<std::vector<Token>>& configs) {
+    std::ifstream in("./marco_config", std::ios::in);
+    if (!in.is_open()) {
+        return 0;
+    }
+    std::string line;
+    while(std::getline(in, line)) {
+        boost::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<Token> marcos;
+        std::vector<std::string> defs;
+        boost::split(defs, line, boost::is_any_of(" \t"), boost::token_compress_on);
+        for (size_t i = 0; i < defs.size(); ++i) {
+            if (defs[i].empty() || defs[i] == "-") {
+                continue;
+            }
+            const size_t eq = defs[i].find('=');
+            Token m(CPP_PREPROCESSOR, "define", -1);
+            m.ts.push_back(Token(CPP_NAME, defs[i].substr(0, eq), -1));
+            if (eq != std::string::npos) {
+                const std::string val = defs[i].substr(eq+1);
+                if (!val.empty()) {
+                    const bool num = isdigit(val[0]) || ((val[0] == '-' || val[0] == '+') && val.size() > 1);
+                    m.ts.push_back(Token(num ? CPP_NUMBER : CPP_NAME, val, -1));
+                }
+            }
+            marcos.push_back(m);
+        }
+        configs.push_back(marcos);
+    }
+
+    in.close();
+
+    return 0;
+}
+
+//可选配置, 不隐藏的公开API(原名), 有这个文件时生成./result/version_script
+static int get_public_api(std::set<std::string>& names) {
+    std::ifstream in("./public_api", std::ios::in);
+    if (!in.is_open()) {
+        return -1;
+    }
+    std::string line;
+    while(std::getline(in, line)) {
+        if (!line.empty() && line[0] != '#') {
+            names.insert(line);
+        }
+    }
+
+    in.close();
+
+    return 0;
+}
+
+//可选配置, 第一行是 输出目录 [link]
+//有这个文件时不修改原文件, 按输入的目录结构输出到这个目录, link时没有修改的文件用硬链接
+static int get_output_root(std::string& root, bool& link) {
+    std::ifstream in("./output_root", std::ios::in);
+    if (!in.is_open()) {
+        return -1;
+    }
+    std::string line;
+    while(std::getline(in, line)) {
+        boost::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> vals;
+        boost::split(vals, line, boost::is_any_of(" \t"), boost::token_compress_on);
+        root = vals[0];
+        link = vals.size() > 1 && vals[1] == "link";
+        break;
+    }
+
+    in.close();
+
+    return root.empty() ? -1 : 0;
+}
+
+//绝对路径, 去掉末尾的/
+static std::string absolute_path(const std::string& path) {
+    std::string p = boost::filesystem::absolute(path).string();
+    while (p.size() > 1 && p.back() == '/') {
+        p.pop_back();
+    }
+    return p;
+}
+
+//所有输入的公共父目录, 输出目录按它的结构镜像
+static std::string get_input_root(const std::vector<std::string>& src_dir) {
+    std::string root;
+    for (size_t i = 0; i < src_dir.size(); ++i) {
+        std::string p = absolute_path(src_dir[i]);
+        if (!Util::is_direction(p)) {
+            p = p.substr(0, p.rfind('/'));
+        }
+        if (i == 0) {
+            root = p;
+            continue;
+        }
+        //按目录截断到公共前缀
+        while (!root.empty() && !(p.compare(0, root.size(), root) == 0 && (p.size() == root.size() || p[root.size()] == '/'))) {
+            root = root.substr(0, root.rfind('/'));
+        }
+    }
+    return root;
+}
+
+//可选配置, 混淆的范围: classes, declarations, full(默认)
+static int get_obfuscate_level(ObfuscateLevel& level) {
+    std::ifstream in("./obfuscate_level", std::ios::in);
+    if (!in.is_open()) {
+        return 0;
+    }
+    std::string line;
+    while(std::getline(in, line)) {
+        boost::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        if (line == "classes") {
+            level = LEVEL_CLASSES;
+        } else if (line == "declarations") {
+            level = LEVEL_DECLARATIONS;
+        } else if (line == "full") {
+            level = LEVEL_FULL;
+        } else {
+            std::cerr << "invalid obfuscate level: " << line << "\n";
+            return -1;
+        }
+        break;
+    }
+
+    in.close();
+
+    return 0;
+}
+
+//可选配置, 第一行是映射库文件的路径, 只有配置了才在hash模式下复用/追加以前分配的名字
+static int get_mapping_db(std::string& path) {
+    std::ifstream in("./mapping_db_path", std::ios::in);
+    if (!in.is_open()) {
+        return -1;
+    }
+    std::string line;
+    while(std::getline(in, line)) {
+        boost::trim(line);
+        if (!line.empty() && line[0] != '#') {
+            path = line;
+            break;
+        }
+    }
+
+    in.close();
+
+    return path.empty() ? -1 : 0;
+}
+
+//SipHash的128位密钥, 第一行是32个十六进制字符
+static int get_hash_key(uint64_t key[2]) {
+    std::ifstream in("./hash_key", std::ios::in);
+    if (!in.is_open()) {
+        std::cerr << "open config hash key failed.\n";  
+        return -1;
+    }
+    std::string line;
+    std::getline(in, line);
+    in.close();
+
+    boost::trim(line);
+    if (line.size() != 32 || line.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+        std::cerr << "hash key should be 32 hex chars.\n";
+        return -1;
+    }
+    key[0] = strtoull(line.substr(0, 16).c_str(), nullptr, 16);
+    key[1] = strtoull(line.substr(16).c_str(), nullptr, 16);
+
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
     bool hash = false;
     if (argc >= 2 && std::string(argv[1]) == "hash") {
         hash = true;
     } 
 
+    //最后一个参数是dry时只输出./result/patch和替换次数, 不修改任何文件
+    const bool dry = argc >= 2 && std::string(argv[argc-1]) == "dry";
+
+    //l1 hash sip: 用./hash_key里的密钥做SipHash
+    //l1 hash short: 按出现次数分配最短的名字
+    //默认MD5
+    HashMode hash_mode = HASH_MD5;
+    uint64_t hash_key[2] = {0, 0};
+    if (hash && argc >= 3 && std::string(argv[2]) == "sip") {
+        hash_mode = HASH_SIP;
+        if (0 != get_hash_key(hash_key)) {
+            return -1;
+        }
+    } else if (hash && argc >= 3 && std::string(argv[2]) == "short") {
+        hash_mode = HASH_SHORT;
+    }
+
     std::vector<std::string> src_dir;
     std::vector<std::string> ig_file;
     std::set<std::string> ig_class;
@@ -135,11 +363,47 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
+    std::set<std::string> public_api;
+
+    std::string output_root;
+    bool output_link = false;
+    std::string input_root;
+    if (0 == get_output_root(output_root, output_link)) {
+        output_root = absolute_path(output_root);
+        input_root = get_input_root(src_dir);
+        if (output_root.compare(0, input_root.size(), input_root) == 0 &&
+            (output_root.size() == input_root.size() || output_root[input_root.size()] == '/')) {
+            std::cerr << "output root should not be in the input root: " << input_root << "\n";
+            return -1;
+        }
+        std::cout << "output root: " << output_root << ", mirror: " << input_root << "\n";
+    }
+
+    std::string mapping_db;
+    if (hash && 0 == get_mapping_db(mapping_db)) {
+        std::cout << "mapping db: " << mapping_db << "\n";
+    }
+
+    ObfuscateLevel level = LEVEL_FULL;
+    if (0 != get_obfuscate_level(level)) {
+        return -1;
+    }
+
+    int infer_budget = DEFAULT_INFER_BUDGET;
+    get_infer_budget(infer_budget);
+
     std::set<std::string> ig_file_set;
     for (size_t i=0; i<ig_file.size(); ++i) {
         ig_file_set.insert(ig_file[i]);
     }
 
+    std::vector<std::vector<Token>> marco_configs;
+    get_marco_configs(marco_configs);
+    if (marco_configs.empty()) {
+        marco_configs.push_back(std::vector<Token>());
+    }
+
+    std::vector<LexFile> lex_files;
     for (size_t j=0; j<src_dir.size(); ++j) {
 
         std::cout << "parse direction: " << src_dir[j] << "\n";
@@ -182,13 +446,18 @@ int main(int argc, char* argv[]) {
                 }
             }
 
+            lex->seal_token();
             lex->stage_token();
             lex->l1();
             lex->l2();
 
             std::string file_name = Util::get_file_name(h_file[i]);
+            std::string out_path;
+            if (!output_root.empty()) {
+                out_path = output_root + absolute_path(h_file[i]).substr(input_root.size());
+            }
 
-            obfuscator.add_lex(file_name, h_file[i], lex, reader);
+            lex_files.push_back({file_name, h_file[i], out_path, lex, reader});
         }
 
         for (size_t i=0; i<c_file.size(); ++i) {
@@ -211,39 +480,126 @@ int main(int argc, char* argv[]) {
                 }
             }
 
+            lex->seal_token();
             lex->stage_token();
 
             lex->l1();
             lex->l2();
 
             std::string file_name = Util::get_file_name(c_file[i]);
+            std::string out_path;
+            if (!output_root.empty()) {
+                out_path = output_root + absolute_path(c_file[i]).substr(input_root.size());
+            }
+
+            lex_files.push_back({file_name, c_file[i], out_path, lex, reader});
+        }
+    }
+
+    //每个宏配置从同一份词法分析的结果开始分析, 替换的token合并后一次写回
+    ReplaceSet replace_set;
+    for (size_t c = 0; c < marco_configs.size(); ++c) {
+        std::cout << "marco config: " << c+1 << "/" << marco_configs.size() << "\n";
+        //最后一个配置直接用原来的token流, 前面的配置用拷贝
+        const bool last = c+1 == marco_configs.size();
+        std::vector<Lex*> lex_copies;
+        Obfuscator obfuscator;
+        for (size_t i = 0; i < lex_files.size(); ++i) {
+            Lex* lex = lex_files[i].lex;
+            if (!last) {
+                lex = new Lex(*lex);
+                lex_copies.push_back(lex);
+            }
+            obfuscator.add_lex(lex_files[i].name, lex_files[i].path, lex, lex_files[i].reader, lex_files[i].out_path);
+        }
+
+        obfuscator.set_ignore_class(ig_class);
+        obfuscator.set_ignore_function(ig_fn);
+        obfuscator.set_ignore_class_function(ig_c_fn_names);
+        obfuscator.set_infer_budget(infer_budget);
+        obfuscator.set_predefined_marco(marco_configs[c]);
+        obfuscator.set_hash(hash_mode, hash_key);
+        obfuscator.set_level(level);
+
+        //classes只需要类的定义, declarations不需要推导类型的pass
+        obfuscator.remove_comments();
+        obfuscator.extract_enum();
+        obfuscator.parse_marco();
+        obfuscator.extract_extern_type();
+        obfuscator.extract_class();
+        if (level >= LEVEL_DECLARATIONS) {
+            obfuscator.extract_typedef();
+            obfuscator.combine_type_with_multi_and_rm_const();
+            if (level == LEVEL_FULL) {
+                obfuscator.extract_decltype();
+                obfuscator.extract_container();
+                obfuscator.combine_type_with_multi_and_rm_const();
+            }
+            obfuscator.extract_class_member();
+            obfuscator.extract_global_var_fn();
+            obfuscator.extract_local_var_fn();
+            if (level == LEVEL_FULL) {
+                obfuscator.label_call();
+            } else {
+                obfuscator.label_free_call();
+            }
+        }
+        obfuscator.collect_replace(replace_set);
+
+        if (last && dry) {
+            //只读映射库, 不追加
+            if (!mapping_db.empty() && 0 != obfuscator.load_mapping_db(mapping_db)) {
+                return -1;
+            }
+            obfuscator.write_patch(replace_set, hash, "./result");
+        } else if (last && !output_root.empty()) {
+            //先把输入目录下没有替换的文件镜像到输出目录, 有替换的由write_replace直接写出
+            std::set<std::string> rewritten;
+            for (auto it = replace_set.files.begin(); it != replace_set.files.end(); ++it) {
+                if (!it->second.empty()) {
+                    rewritten.insert(absolute_path(it->first));
+                }
+            }
+            int clone_num = 0;
+            for (size_t j = 0; j < src_dir.size(); ++j) {
+                std::vector<std::string> files;
+                if (Util::is_direction(src_dir[j])) {
+                    Util::get_all_file_recursion(src_dir[j], std::set<std::string>(), files);
+                } else {
+                    files.push_back(src_dir[j]);
+                }
+                for (size_t i = 0; i < files.size(); ++i) {
+                    const std::string src = absolute_path(files[i]);
+                    if (rewritten.find(src) != rewritten.end()) {
+                        continue;
+                    }
+                    if (0 == Util::clone_file(src, output_root + src.substr(input_root.size()), output_link)) {
+                        ++clone_num;
+                    }
+                }
+            }
+            std::cout << "mirror " << clone_num << " files to " << output_root << ", " << rewritten.size() << " rewritten files skipped\n";
+        }
 
-            obfuscator.add_lex(file_name, c_file[i], lex, reader);
-        }
-    }
-
-    obfuscator.set_ignore_class(ig_class);
-    obfuscator.set_ignore_function(ig_fn);
-    obfuscator.set_ignore_class_function(ig_c_fn_names);
-
-    obfuscator.remove_comments();
-    obfuscator.extract_enum();
-    obfuscator.parse_marco();
-    obfuscator.extract_extern_type();
-    obfuscator.extract_class();
-    obfuscator.extract_typedef();
-    obfuscator.combine_type_with_multi_and_rm_const();
-    obfuscator.extract_decltype();
-    obfuscator.extract_container();
-    obfuscator.combine_type_with_multi_and_rm_const();
-    obfuscator.extract_class_member();
-    obfuscator.extract_global_var_fn();
-    obfuscator.extract_local_var_fn();
-    obfuscator.label_call();
-    obfuscator.label_fn_as_parameter();
-    obfuscator.replace_call(hash);
-    
-    obfuscator.debug("./result");
+        if (last && !dry) {
+            //配置了映射库时复用里面以前分配的名字, 并追加这次新分配的
+            if (!mapping_db.empty() && 0 != obfuscator.load_mapping_db(mapping_db)) {
+                return -1;
+            }
+            obfuscator.write_replace(replace_set, hash);
+            if (!mapping_db.empty()) {
+                obfuscator.save_mapping_db();
+            }
+            obfuscator.debug("./result");
+            if (hash && 0 == get_public_api(public_api)) {
+                obfuscator.write_version_script("./result/version_script", public_api);
+            }
+        }
+
+        for (size_t i = 0; i < lex_copies.size(); ++i) {
+            delete lex_copies[i];
+        }
+    }
 
     return 0;
 }
@@ -0,0 +1,231 @@
+#include "marco_table.h"
+
+//宏嵌套展开的最大深度, 超过后剩下的宏保持原样
+const static int MAX_EXPAND_DEPTH = 64;
+
+static inline bool is_marco_name(const Token& t) {
+    return t.type == CPP_NAME || t.type == CPP_MACRO;
+}
+
+static bool has_paste(const Token& m) {
+    for (auto it = m.ts.begin(); it != m.ts.end(); ++it) {
+        if (it->type == CPP_PASTE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//t指向宏名, 收集后面(...)中按顶层逗号分开的参数, 成功后t指向)之后
+template <typename It>
+static bool collect_args(It& t, It t_end, std::vector<std::vector<Token>>& args) {
+    It it = t+1;
+    if (it == t_end || it->type != CPP_OPEN_PAREN) {
+        return false;
+    }
+    ++it;
+    args.clear();
+    args.push_back(std::vector<Token>());
+    int depth = 0;
+    for (; it != t_end; ++it) {
+        if (it->type == CPP_OPEN_PAREN) {
+            ++depth;
+        } else if (it->type == CPP_CLOSE_PAREN) {
+            if (depth == 0) {
+                t = it+1;
+                return true;
+            }
+            --depth;
+        } else if (it->type == CPP_COMMA && depth == 0) {
+            args.push_back(std::vector<Token>());
+            continue;
+        }
+        args.back().push_back(*it);
+    }
+    return false;
+}
+
+MarcoTable::MarcoTable() {
+
+}
+
+MarcoTable::~MarcoTable() {
+
+}
+
+void MarcoTable::clear() {
+    _marcos.clear();
+    _index.clear();
+    _expanded.clear();
+    _expanding.clear();
+}
+
+void MarcoTable::add(const Token& m) {
+    _marcos.push_back(m);
+    if (!m.ts.empty() && _index.find(m.ts[0].val) == _index.end()) {
+        _index[m.ts[0].val] = _marcos.size()-1;
+    }
+}
+
+bool MarcoTable::find(const std::string& name) const {
+    return _index.find(name) != _index.end();
+}
+
+bool MarcoTable::find(const std::string& name, Token& m) const {
+    auto it = _index.find(name);
+    if (it == _index.end()) {
+        return false;
+    }
+    m = _marcos[it->second];
+    return true;
+}
+
+const std::vector<Token>& MarcoTable::all() const {
+    return _marcos;
+}
+
+bool MarcoTable::is_function(const Token& m) {
+    //宏名后面紧跟(
+    return m.ts.size() > 1 && m.ts[1].type == CPP_OPEN_PAREN &&
+        m.ts[1].loc == m.ts[0].loc + (int)m.ts[0].val.size();
+}
+
+void MarcoTable::function_paras(const Token& m, std::vector<std::string>& paras, size_t& body) const {
+    paras.clear();
+    body = m.ts.size();
+    for (size_t i = 2; i < m.ts.size(); ++i) {
+        if (m.ts[i].type == CPP_CLOSE_PAREN) {
+            body = i+1;
+            return;
+        } else if (m.ts[i].type == CPP_ELLIPSIS) {
+            paras.push_back("__VA_ARGS__");
+        } else if (m.ts[i].type != CPP_COMMA) {
+            paras.push_back(m.ts[i].val);
+        }
+    }
+}
+
+const std::vector<Token>& MarcoTable::expand(const std::string& name) {
+    //正在展开的宏在结果里不再展开, 所以缓存的key是 名字+正在展开的宏
+    std::string key = name;
+    for (auto it = _expanding.begin(); it != _expanding.end(); ++it) {
+        key.push_back('\0');
+        key += *it;
+    }
+    auto it_e = _expanded.find(key);
+    if (it_e != _expanded.end()) {
+        return it_e->second;
+    }
+
+    std::vector<Token> body;
+    auto it = _index.find(name);
+    if (it != _index.end()) {
+        const Token& m = _marcos[it->second];
+        size_t begin = 1;
+        std::vector<std::string> paras;
+        if (is_function(m)) {
+            function_paras(m, paras, begin);
+        }
+        //函数宏的参数名不能当成宏展开
+        std::set<std::string> expanding0 = _expanding;
+        _expanding.insert(name);
+        _expanding.insert(paras.begin(), paras.end());
+        std::vector<Token> raw(m.ts.begin()+std::min(begin, m.ts.size()), m.ts.end());
+        expand_tokens(raw, body, 0);
+        _expanding.swap(expanding0);
+    }
+    return _expanded[key] = body;
+}
+
+void MarcoTable::expand_tokens(const std::vector<Token>& ts, std::vector<Token>& out, int depth) {
+    for (auto t = ts.begin(); t != ts.end(); ) {
+        Token m;
+        if (!is_marco_name(*t) || depth > MAX_EXPAND_DEPTH ||
+            _expanding.find(t->val) != _expanding.end() || !find(t->val, m) || has_paste(m)) {
+            out.push_back(*(t++));
+            continue;
+        }
+
+        if (!is_function(m)) {
+            const std::vector<Token>& body = expand(t->val);
+            out.insert(out.end(), body.begin(), body.end());
+            ++t;
+            continue;
+        }
+
+        std::vector<std::vector<Token>> args;
+        auto t_call = t;
+        if (collect_args(t_call, ts.end(), args) && expand_call(m, args, out, depth+1)) {
+            t = t_call;
+        } else {
+            out.push_back(*(t++));
+        }
+    }
+}
+
+bool MarcoTable::expand_call(const Token& m, const std::vector<std::vector<Token>>& args, std::vector<Token>& out, int depth) {
+    const std::string& name = m.ts[0].val;
+    std::vector<std::string> paras;
+    size_t begin = 0;
+    function_paras(m, paras, begin);
+
+    const bool variadic = !paras.empty() && paras.back() == "__VA_ARGS__";
+    const size_t fixed = variadic ? paras.size()-1 : paras.size();
+    if (paras.empty()) {
+        if (args.size() != 1 || !args[0].empty()) {
+            return false;
+        }
+    } else if (variadic ? args.size() < fixed : args.size() != fixed) {
+        return false;
+    }
+
+    //参数先展开再替换
+    const std::vector<Token>& body = expand(name);
+    std::vector<Token> replaced;
+    for (auto t = body.begin(); t != body.end(); ++t) {
+        size_t p = paras.size();
+        if (is_marco_name(*t)) {
+            p = std::find(paras.begin(), paras.end(), t->val) - paras.begin();
+        }
+        if (p == paras.size()) {
+            replaced.push_back(*t);
+        } else if (variadic && p == fixed) {
+            for (size_t i = fixed; i < args.size(); ++i) {
+                if (i != fixed) {
+                    replaced.push_back({CPP_COMMA, ",", -1});
+                }
+                expand_tokens(args[i], replaced, depth);
+            }
+        } else {
+            expand_tokens(args[p], replaced, depth);
+        }
+    }
+
+    //替换后再扫描一次, 这时不再展开自己
+    _expanding.insert(name);
+    expand_tokens(replaced, out, depth);
+    _expanding.erase(name);
+    return true;
+}
+
+bool MarcoTable::expand_at(std::deque<Token>::iterator& t, std::deque<Token>::iterator t_end, std::vector<Token>& out) {
+    Token m;
+    if (!find(t->val, m) || has_paste(m)) {
+        return false;
+    }
+
+    if (!is_function(m)) {
+        const std::vector<Token>& body = expand(t->val);
+        out.insert(out.end(), body.begin(), body.end());
+        ++t;
+        return true;
+    }
+
+    std::vector<std::vector<Token>> args;
+    auto t_call = t;
+    if (!collect_args(t_call, t_end, args) || !expand_call(m, args, out, 0)) {
+        return false;
+    }
+    t = t_call;
+    return true;
+}
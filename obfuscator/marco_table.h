@@ -0,0 +1,44 @@
+#ifndef MY_MARCO_TABLE_H
+#define MY_MARCO_TABLE_H
+
+#include "common.h"
+#include <unordered_map>
+
+//全局宏表
+//按名字索引#define token(ts[0]是宏名, 后面是宏体), 同名的取第一个
+//宏体里嵌套的宏只展开一次并缓存, 函数宏在调用处替换参数后再展开
+class MarcoTable {
+public:
+    MarcoTable();
+    ~MarcoTable();
+
+    void clear();
+    void add(const Token& m);
+    bool find(const std::string& name) const;
+    bool find(const std::string& name, Token& m) const;
+    const std::vector<Token>& all() const;
+
+    static bool is_function(const Token& m);
+
+    //展开后的宏体, 函数宏是替换参数之前的宏体
+    const std::vector<Token>& expand(const std::string& name);
+
+    //展开从t开始的宏调用, 结果追加到out, t移到调用之后
+    //函数宏后面没有(...), 或者宏体里有#/##时不展开, 返回false
+    bool expand_at(std::deque<Token>::iterator& t, std::deque<Token>::iterator t_end, std::vector<Token>& out);
+
+private:
+    void expand_tokens(const std::vector<Token>& ts, std::vector<Token>& out, int depth);
+    bool expand_call(const Token& m, const std::vector<std::vector<Token>>& args, std::vector<Token>& out, int depth);
+
+    //函数宏的参数名和宏体的起始位置
+    void function_paras(const Token& m, std::vector<std::string>& paras, size_t& body) const;
+
+private:
+    std::vector<Token> _marcos;
+    std::unordered_map<std::string, size_t> _index;
+    std::unordered_map<std::string, std::vector<Token>> _expanded;//<名字\0正在展开的宏..., 展开结果>
+    std::set<std::string> _expanding;//正在展开的宏, 防止自引用
+};
+
+#endif
@@ -1,12 +1,36 @@
 #include "obfuscator.h"
 #include "util.h"
+#include "token_pattern.h"
+#include "cond_expr.h"
 
 //------------------------------------------------------------------------------------------------------//
 //common function begin
 //------------------------------------------------------------------------------------------------------//
 
-static inline void jump_brace(std::deque<Token>::iterator& t, const std::deque<Token>& ts) {
+//查找t在流ts中的配对括号, 没有配对/t不在ts中/两端已经不是一对括号(type被改过) 返回false, 由调用者逐个扫描
+//配对表按ts的修改计数失效重建, 每个流各自持有
+static inline bool find_pair(std::deque<Token>::iterator t, const TokenStream& ts, std::deque<Token>::iterator& pair) {
+    const long pos = t - ts.begin();
+    if (pos < 0 || pos >= (long)ts.size() || &ts[pos] != &(*t)) {
+        return false;
+    }
+    const int p = ts.brackets().pair(pos);
+    if (p < 0) {
+        return false;
+    }
+    auto t_p = t + (p - pos);
+    if (p > pos ? !BracketIndex::is_pair(t->type, t_p->type) : !BracketIndex::is_pair(t_p->type, t->type)) {
+        return false;
+    }
+    pair = t_p;
+    return true;
+}
+
+static inline void jump_brace(std::deque<Token>::iterator& t, const TokenStream& ts) {
     assert(t->type == CPP_OPEN_BRACE || t->type == CPP_CLASS_BEGIN);
+    if (find_pair(t, ts, t)) {
+        return;
+    }
     std::stack<Token> ss;
     ss.push(*t);
     ++t;
@@ -27,8 +51,11 @@ static inline void jump_brace(std::deque<Token>::iterator& t, const std::deque<T
     }
 }
 
-static inline void jump_angle_brace(std::deque<Token>::iterator& t, const std::deque<Token>& ts) {
+static inline void jump_angle_brace(std::deque<Token>::iterator& t, const TokenStream& ts) {
     assert(t->type == CPP_LESS);
+    if (find_pair(t, ts, t)) {
+        return;
+    }
     std::stack<Token> ss;
     ss.push(*t);
     ++t;
@@ -49,8 +76,13 @@ static inline void jump_angle_brace(std::deque<Token>::iterator& t, const std::d
     }
 }
 
-static inline int jump_angle_brace(std::deque<Token>::iterator& t, std::deque<Token>::iterator t_end) {
+static inline int jump_angle_brace(std::deque<Token>::iterator& t, std::deque<Token>::iterator t_end, const TokenStream& ts) {
     assert(t->type == CPP_LESS);
+    std::deque<Token>::iterator t_p;
+    if (find_pair(t, ts, t_p) && t_p < t_end) {
+        t = t_p;
+        return 0;
+    }
     std::stack<Token> ss;
     ss.push(*t);
     ++t;
@@ -75,8 +107,11 @@ static inline int jump_angle_brace(std::deque<Token>::iterator& t, std::deque<To
     return 0;
 }
 
-static inline void jump_square(std::deque<Token>::iterator& t) {
+static inline void jump_square(std::deque<Token>::iterator& t, const TokenStream& ts) {
     assert(t->type == CPP_OPEN_SQUARE);
+    if (find_pair(t, ts, t)) {
+        return;
+    }
     std::stack<Token> ss;
     ss.push(*t);
     ++t;
@@ -96,36 +131,17 @@ static inline void jump_square(std::deque<Token>::iterator& t) {
     }
 }
 
-static inline void jump_paren(std::deque<Token>::iterator& t, const std::deque<Token>& ts) {
+static inline void jump_paren(std::deque<Token>::iterator& t, const TokenStream& ts) {
     std::stack<Token> s_de;
-    while (t->type != CPP_OPEN_PAREN && t != ts.end()) {
+    while(t != ts.end() && t->type != CPP_OPEN_PAREN) {
         ++t;
     }
     if (t == ts.end()) {
         return;
     }
-    s_de.push(*t);
-    // )
-    ++t;
-    while (!s_de.empty()) {
-        if (t->type == CPP_CLOSE_PAREN) {
-            s_de.pop();
-            if (s_de.empty()) {
-                continue;
-            }
-            ++t;
-        } else if (t->type == CPP_OPEN_PAREN) {
-            s_de.push(*t);
-            ++t;
-        } else {
-            ++t;
-        }
+    if (find_pair(t, ts, t)) {
+        return;
     }
-};
-
-static inline void jump_paren(std::deque<Token>::iterator& t) {
-    std::stack<Token> s_de;
-    assert(t->type == CPP_OPEN_PAREN);
     s_de.push(*t);
     // )
     ++t;
@@ -145,66 +161,100 @@ static inline void jump_paren(std::deque<Token>::iterator& t) {
     }
 };
 
-static void jump_before_square(std::deque<Token>::iterator& t, const std::deque<Token>::iterator t_start) {
+static void jump_before_square(std::deque<Token>::iterator& t, const std::deque<Token>::iterator t_start, const TokenStream& ts) {
     assert(t->type == CPP_CLOSE_SQUARE);
-    std::stack<Token> ts;
-    ts.push(*t);
+    std::deque<Token>::iterator t_p;
+    if (find_pair(t, ts, t_p) && t_p >= t_start) {
+        t = t_p-1;
+        return;
+    }
+    std::stack<Token> ss;
+    ss.push(*t);
     --t;
-    while (!ts.empty()&& t>=t_start) {
+    while (!ss.empty()&& t>=t_start) {
         if(t->type == CPP_OPEN_SQUARE) {
-            ts.pop();
+            ss.pop();
         } else if (t->type == CPP_CLOSE_SQUARE) {
-            ts.push(*t);
+            ss.push(*t);
         }
         --t;
     }
 }
 
-static void jump_before_praen(std::deque<Token>::iterator& t, const std::deque<Token>::iterator t_start) {
+static void jump_before_praen(std::deque<Token>::iterator& t, const std::deque<Token>::iterator t_start, const TokenStream& ts) {
     assert(t->type == CPP_CLOSE_PAREN);
-    std::stack<Token> ts;
-    ts.push(*t);
-    --t;
-    while (!ts.empty() && t>=t_start) {
-        if(t->type == CPP_OPEN_PAREN) {
-            ts.pop();
-        } else if (t->type == CPP_CLOSE_PAREN) {
-            ts.push(*t);
-        }
-        --t;
+    std::deque<Token>::iterator t_p;
+    if (find_pair(t, ts, t_p) && t_p >= t_start) {
+        t = t_p-1;
+        return;
     }
-}
-
-static void jump_before_praen(std::deque<Token>::iterator& t) {
-    assert(t->type == CPP_CLOSE_PAREN);
-    std::stack<Token> ts;
-    ts.push(*t);
+    std::stack<Token> ss;
+    ss.push(*t);
     --t;
-    while (!ts.empty()) {
+    while (!ss.empty() && t>=t_start) {
         if(t->type == CPP_OPEN_PAREN) {
-            ts.pop();
+            ss.pop();
         } else if (t->type == CPP_CLOSE_PAREN) {
-            ts.push(*t);
+            ss.push(*t);
         }
         --t;
     }
 }
 
-static void jump_before_angle_brace(std::deque<Token>::iterator& t, const std::deque<Token>::iterator t_start) {
+static void jump_before_angle_brace(std::deque<Token>::iterator& t, const std::deque<Token>::iterator t_start, const TokenStream& ts) {
     assert(t->type == CPP_GREATER);
-    std::stack<Token> ts;
-    ts.push(*t);
+    std::deque<Token>::iterator t_p;
+    if (find_pair(t, ts, t_p) && t_p >= t_start) {
+        t = t_p-1;
+        return;
+    }
+    std::stack<Token> ss;
+    ss.push(*t);
     --t;
-    while (!ts.empty() && t>=t_start) {
+    while (!ss.empty() && t>=t_start) {
         if(t->type == CPP_LESS) {
-            ts.pop();
+            ss.pop();
         } else if (t->type == CPP_GREATER) {
-            ts.push(*t);
+            ss.push(*t);
         }
         --t;
     }
 }
 
+//get_subject_type推导t的类型时依赖的前缀主语(a->b 中 b依赖a, fn()->b 中依赖fn的主语), 没有则返回false
+static bool subject_receiver(std::deque<Token>::iterator t, const std::deque<Token>::iterator t_start, const TokenStream& ts, std::deque<Token>::iterator& t_r) {
+    auto t_p = t-1;
+    if (t->val == "this") {
+        return false;
+    } else if ((t->val == "first" || t->val == "second" || t->type == CPP_NAME) &&
+               (t_p->type == CPP_DOT || t_p->type == CPP_POINTER)) {
+        t_r = t-2;
+        return true;
+    } else if (t->type == CPP_CLOSE_SQUARE) {
+        t_r = t;
+        jump_before_square(t_r, t_start, ts);
+        return true;
+    } else if (t->type == CPP_CLOSE_PAREN) {
+        auto t_fn = t;
+        jump_before_praen(t_fn, t_start, ts);
+        if (t_fn->type == CPP_NAME || t_fn->type == CPP_CALL) {
+            if ((t_fn-1)->type == CPP_POINTER || (t_fn-1)->type == CPP_DOT) {
+                t_r = t_fn-2;
+                return true;
+            }
+            return false;
+        } else if (t_fn->type == CPP_MEMBER_FUNCTION || t_fn->type == CPP_TYPE || 
+            t_fn->val == "typeid" || t_fn->type == CPP_GREATER) {
+            return false;
+        } else {
+            //括号包裹的表达式, 取括号内最后一个元素
+            t_r = t-1;
+            return true;
+        }
+    }
+    return false;
+}
+
 static inline void print_token(const Token& t, std::ostream& out) {
     out << t.val << " ";
     for (auto it2 = t.ts.begin(); it2 != t.ts.end(); ++it2) {
@@ -220,20 +270,123 @@ static inline bool is_source_file(const std::string& file_name) {
 
 //------------------------------------------------------------------------------------------------------//
 //common function end
-//------------------------------------------------------------------------------------------------------//
+//短名字不能用的C/C++库名字和常见的宏, 源码里没有出现但是头文件里可能有
+static const char* reserved_c_names[] = {
+"EOF", "NULL", "FILE", "DIR", "TRUE", "FALSE", "BOOL", "BYTE", "WORD", "DWORD", "PI",
+"min", "max", "near", "far", "main", "errno", "assert", "stdin", "stdout", "stderr", "environ",
+"abs", "div", "exp", "log", "pow", "sin", "cos", "tan", "erf", "cbrt", "ceil", "fabs", "fmod", "sqrt",
+"sinh", "cosh", "tanh", "asin", "acos", "atan", "atof", "atoi", "atol", "labs", "ldiv", "exp2", "log2",
+"fmin", "fmax", "fdim", "fma", "nan", "rint", "modf", "hypot", "round", "trunc", "floor", "frexp", "ldexp",
+"feof", "getc", "gets", "putc", "puts", "rand", "free", "time", "exit", "read", "open", "close", "write",
+"dup", "dup2", "pipe", "fork", "kill", "link", "nice", "sync", "sbrk", "brk", "stat", "wait", "send", "recv",
+"bind", "poll", "swab", "sleep", "alarm", "pause", "signal", "raise", "clock", "abort", "qsort", "ftell",
+"fopen", "fread", "fseek", "gcvt", "ecvt", "fcvt", "y0", "y1", "yn", "j0", "j1", "jn", "gamma",
+"std", "tm", "va_list", "jmp_buf", "select", "index", "random", "remove", "rename", "system"
+};
+
+static bool is_reserved_c_name(const std::string& name) {
+    static std::unordered_set<std::string> names(
+        reserved_c_names, reserved_c_names + sizeof(reserved_c_names)/sizeof(char*));
+    return names.find(name) != names.end();
+}
+
+//系统头文件里的宏多是全大写(B0, B50, EOF)或者大写开头的很短的名字(I), 这些短名字都不用
+static bool is_macro_like_name(const std::string& name) {
+    if (name.empty() || !(isupper(name[0]) || name[0] == '_')) {
+        return false;
+    }
+    if (name.size() <= 3 && isupper(name[0])) {
+        return true;
+    }
+    for (auto it = name.begin(); it != name.end(); ++it) {
+        if (!(isupper(*it) || isdigit(*it) || *it == '_')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//映射库记录的hash方式
+static const char* mapping_db_mode(HashMode mode) {
+    switch (mode) {
+    case HASH_SIP: return "sip";
+    case HASH_SHORT: return "short";
+    default: return "md5";
+    }
+}
+
+//按\n切分, 最后一行没有\n时也算一行
+static void split_lines(const std::string& code, std::vector<std::string>& lines) {
+    lines.clear();
+    size_t begin = 0;
+    while (true) {
+        const size_t end = code.find('\n', begin);
+        if (end == std::string::npos) {
+            lines.push_back(code.substr(begin));
+            break;
+        }
+        lines.push_back(code.substr(begin, end-begin));
+        begin = end+1;
+    }
+}
+
+static inline void add_replace(ReplaceSet& replace_set, std::vector<ReplaceRecord>& records, const Token& t) {
+    auto it = replace_set.sym_index.find(t.val);
+    uint32_t sym = 0;
+    if (it == replace_set.sym_index.end()) {
+        sym = replace_set.syms.size();
+        replace_set.syms.push_back(t.val);
+        replace_set.sym_index[t.val] = sym;
+    } else {
+        sym = it->second;
+    }
+    records.push_back({(uint32_t)t.loc, (uint32_t)t.val.size(), sym});
+}
+
+//按loc的LSD基数排序, 每次16位, 稳定
+static void radix_sort_by_loc(std::vector<ReplaceRecord>& records) {
+    std::vector<ReplaceRecord> tmp(records.size());
+    std::vector<size_t> count(1<<16);
+    for (int shift = 0; shift < 32; shift += 16) {
+        std::fill(count.begin(), count.end(), 0);
+        for (auto it = records.begin(); it != records.end(); ++it) {
+            ++count[(it->loc >> shift) & 0xFFFF];
+        }
+        size_t sum = 0;
+        for (auto it = count.begin(); it != count.end(); ++it) {
+            const size_t c = *it;
+            *it = sum;
+            sum += c;
+        }
+        for (auto it = records.begin(); it != records.end(); ++it) {
+            tmp[count[(it->loc >> shift) & 0xFFFF]++] = *it;
+        }
+        records.swap(tmp);
+    }
+}
 
-Obfuscator::Obfuscator() {
+//------------------------------------------------------------------------------------------------------//
 
+Obfuscator::Obfuscator():_infer_depth(0),_label_ts(nullptr),_infer_budget(DEFAULT_INFER_BUDGET),_hash_mode(HASH_MD5),_level(LEVEL_FULL) {
+    _hash_key[0] = 0;
+    _hash_key[1] = 0;
+    Scope root;
+    root.type = 0;
+    root.depth = 0;
+    root.father = ROOT_SCOPE;
+    _scopes.push_back(root);
+    _scope_ids[""] = ROOT_SCOPE;
 }
 
 Obfuscator::~Obfuscator() {
 
 }
 
-void Obfuscator::add_lex(const std::string& file_name, const std::string& file_path, Lex* lex, Reader* reader) {
+void Obfuscator::add_lex(const std::string& file_name, const std::string& file_path, Lex* lex, Reader* reader, const std::string& out_path) {
 
     _file_name.push_back(file_name);
     _file_path.push_back(file_path);
+    _out_path.push_back(out_path.empty() ? file_path : out_path);
     _lex.push_back(lex);
     _readers.push_back(reader);
 }
@@ -247,11 +400,73 @@ Lex* Obfuscator::get_lex(const std::string& file_name) {
     return nullptr;
 }
 
+ScopeID Obfuscator::get_scope(ScopeID father, const std::string& name, int type) {
+    const std::string& father_key = _scopes[father].key;
+    const std::string key = father_key.empty() ? name : father_key + "::" + name;
+    auto it = _scope_ids.find(key);
+    if (it != _scope_ids.end()) {
+        return it->second;
+    }
+
+    Scope sub;
+    sub.name = name;
+    sub.key = key;
+    sub.type = type;
+    sub.depth = 0;
+    sub.father = father;
+    const ScopeID id = (ScopeID)_scopes.size();
+    _scopes.push_back(sub);
+    _scope_ids[key] = id;
+    return id;
+}
+
+ScopeID Obfuscator::enter_scope(ScopeID father, const std::string& name, int type) {
+    const ScopeID id = get_scope(father, name, type);
+    //namespace的 { 已经被略过, 深度从1开始
+    _scopes[id].depth = 1;
+    return id;
+}
+
+bool Obfuscator::update_scope(std::deque<Token>::iterator& t, const TokenStream& ts, ScopeID& cur_scope, bool anonymous) {
+    if (Pattern<Kw<KwNamespace>, Is<CPP_NAME>, Is<CPP_OPEN_BRACE>>::match(t, ts)) {
+        cur_scope = enter_scope(cur_scope, (t+1)->val, 0);
+        t+=3;
+        return true;
+    } else if (Pattern<Kw<KwNamespace>, Is<CPP_OPEN_BRACE>>::match(t, ts)) {
+        if (!anonymous) {
+            //不可以在匿名域中定义class
+            ++t;
+            jump_brace(t, ts);
+            ++t;
+            return true;
+        }
+        //匿名区域
+        cur_scope = enter_scope(cur_scope, ANONYMOUS_SCOPE, 0);
+        t+=2;
+        return true;
+    } else if (t->type == CPP_OPEN_BRACE) {
+        ++_scopes[cur_scope].depth;
+        ++t;
+        return true;
+    } else if (t->type == CPP_CLOSE_BRACE) {
+        Scope& scope = _scopes[cur_scope];
+        --scope.depth;
+        if (cur_scope != ROOT_SCOPE && scope.depth == 0) {
+            //如果不是默认作用域 则跳出当前作用域
+            cur_scope = scope.father;
+        }
+        ++t;
+        return true;
+    }
+
+    return false;
+}
+
 void Obfuscator::remove_comments() {
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        TokenStream& ts = lex._ts;
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             if (t->type == CPP_COMMENT) {
                 t = ts.erase(t);
             } else {
@@ -261,19 +476,32 @@ void Obfuscator::remove_comments() {
     }
 }
 
+//#ifndef X 紧跟 #define X
+static bool is_include_guard(const TokenStream& ts, int i) {
+    const Token& t = ts[i];
+    if (t.val != "ifndef" || t.ts.empty() || i+1 >= (int)ts.size()) {
+        return false;
+    }
+    const Token& next = ts[i+1];
+    return next.type == CPP_PREPROCESSOR && next.val == "define" && !next.ts.empty() && next.ts[0].val == t.ts[0].val;
+}
+
 void Obfuscator::parse_marco() {
+    //宏配置里预定义的宏在最前面, 覆盖源码里的同名宏
+    _g_marco.clear();
+    for (auto it = _predefined_marco.begin(); it != _predefined_marco.end(); ++it) {
+        _g_marco.add(*it);
+    }
+
     //l1 找纯粹的 define
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        TokenStream& ts = lex._ts;
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             if (t->type == CPP_PREPROCESSOR && t->val == "define") {
-                if (t == ts.begin()) {
-                    //t->type = CPP_MACRO;
-                    _g_marco.push_back(*t);
-                } else if ((t-1)->type != CPP_PREPROCESSOR) {
+                if ((t-1)->type != CPP_PREPROCESSOR) {
                     //t->type = CPP_MACRO;
-                    _g_marco.push_back(*t);
+                    _g_marco.add(*t);
                 }
                 ++t;
                 continue;
@@ -283,126 +511,174 @@ void Obfuscator::parse_marco() {
         }
     } 
 
-    //l2 解析所有 #ifdef else #endif 和 #ifndef else #endif 条件判断语句, 进一步抽取全局宏
+    //l2 用条件分支索引解析 #if/#ifdef/#ifndef/#elif/#else/#endif, 进一步抽取全局宏
+    //   不走的分支整段删掉(保留条件指令本身), 后续的阶段不会再看到这些token
+    //   条件只用宏配置和同一个文件前面的#define/#undef判断, 其他文件的宏不一定在这个编译单元里
+    MarcoTable config_marco;
+    for (auto it = _predefined_marco.begin(); it != _predefined_marco.end(); ++it) {
+        config_marco.add(*it);
+    }
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
-            if (t->type == CPP_PREPROCESSOR && (t->val == "ifndef" || t->val == "ifdef")) {
-                //预处理语句开始
-                std::stack<Token> is;
-                while(true) {
-                    is.push(*t);
-                    if(is.top().val == "ifndef" || is.top().val == "ifdef") {
-                        assert(!is.top().ts.empty());
-                        bool target = is.top().val == "ifdef";
-                        if (target == is_in_marco(is.top().ts[0].val)) {
-                            //执行下一句
-                            ++t;
-                            continue;
-                        } else {
-                            //执行else分支, 找else 或者 endif
-                            ++t;
-                            std::stack<Token> is_r;
-
-                    GET_ELSE_BRANCH:                        
+        TokenStream& ts = lex._ts;
+        CondIndex& conds = lex.conditions();
+        std::vector<std::pair<int, int>> dead;//[begin, end)
+        int depth = 0;
+        //这个文件里到当前位置可见的宏 <宏名, #define>, nullptr表示被#undef了, 没有记录的不确定
+        std::unordered_map<std::string, const Token*> visible;
+        //当前位置是不是一定会编译, 不确定的分支里的#define/#undef只能让宏变成不确定
+        std::vector<bool> sure_stack;
+        std::unordered_map<int, bool> branch_sure;
+        const auto set_visible = [&](const Token& t, const Token* def) {
+            if (t.ts.empty()) {
+                return;
+            }
+            if (sure_stack.empty() || sure_stack.back()) {
+                visible[t.ts[0].val] = def;
+            } else {
+                visible.erase(t.ts[0].val);
+            }
+        };
+        const CondExpr::MacroLookup lookup = [&](const std::string& m, Token& val) {
+            if (config_marco.find(m, val)) {
+                return 1;
+            }
+            auto it_v = visible.find(m);
+            if (it_v == visible.end()) {
+                return -1;
+            }
+            if (!it_v->second) {
+                return 0;
+            }
+            val = *(it_v->second);
+            return 1;
+        };
+        const int t_end = (int)ts.size() - TOKEN_PAD;
+        for (int i = TOKEN_PAD; i < t_end; ) {
+            const Token& t = ts[i];
+            if (t.type == CPP_HEADER_NAME) {
+                //头文件里可能定义或者取消任何宏
+                visible.clear();
+                ++i;
+                continue;
+            }
+            if (t.type != CPP_PREPROCESSOR) {
+                ++i;
+                continue;
+            }
+            if (t.val == "define") {
+                //条件分支里的宏, 以及l1漏掉的连续define
+                if (depth > 0 || (!t.ts.empty() && !is_in_marco(t.ts[0].val))) {
+                    _g_marco.add(t);
+                }
+                set_visible(t, &t);
+                ++i;
+                continue;
+            }
+            if (t.val == "undef") {
+                set_visible(t, nullptr);
+                ++i;
+                continue;
+            }
+            if (t.val == "endif") {
+                depth = depth > 0 ? depth-1 : 0;
+                if (!sure_stack.empty()) {
+                    sure_stack.pop_back();
+                }
+                ++i;
+                continue;
+            }
 
-                            while(!(t->val == "else" || t->val == "endif" || t->val == "ifdef" || t->val == "ifndef")) {
-                                ++t;
-                            }
-                            if (is_r.empty() && t->val == "else") {
-                                //找到else
-                                ++t;
-                                continue;
-                            } else if (is_r.empty() && t->val == "endif") {
-                                //找到终结的endif
-                                continue;
-                            } else if (!is_r.empty() && (t->val == "ifdef" || t->val== "ifndef")) {
-                                //还没有遇到结束else分支, 就又遇到了嵌套的条件语句(不走的)
-                                is_r.push(*(t++));
-                                goto GET_ELSE_BRANCH;
-                            } else if (!is_r.empty() && t->val == "endif") {
-                                is_r.pop();
-                                ++t;
-                                goto GET_ELSE_BRANCH;
-                            }
-                        }
-                    } else if (is.top().val == "endif"){
-                        is.pop();
-                        is.pop();
-                        if (is.empty()) {
-                            break;
-                        }
-                        ++t;
-                    } else if (is.top().val == "define") {
-                        //执行
-                        _g_marco.push_back(is.top());
-                        is.pop();
-                        ++t;
-                    } else {
-                        //不是相关预处理代码
-                        //std::cout << "Err:" << is.top().val << "\n";
-                        is.pop();
-                        ++t;
+            const int b = conds.branch(i);
+            if (b < 0) {
+                ++i;
+                continue;
+            }
+            if (t.val == "if" || t.val == "ifdef" || t.val == "ifndef") {
+                //一组分支开始, 只删除确定不走的分支: 自己确定不成立, 或者前面有确定成立的分支
+                //遇到不能判断的分支后, 后面的分支都保留
+                ++depth;
+                bool taken = false;
+                bool unknown = false;
+                const bool parent_sure = sure_stack.empty() || sure_stack.back();
+                sure_stack.push_back(false);
+                for (int bb = b; bb >= 0; bb = conds.branch(conds.get(bb).end)) {
+                    CondBranch& br = conds.get(bb);
+                    int v = (taken || unknown) ? -1 : eval_condition(ts[br.begin], lookup);
+                    if (v < 0 && bb == b && is_include_guard(ts, br.begin)) {
+                        //头文件保护宏, 第一次包含时一定编译
+                        v = 1;
+                    }
+                    const bool dead_branch = taken || (!unknown && v == 0);
+                    br.active = !dead_branch;
+                    branch_sure[bb] = parent_sure && !taken && !unknown && v == 1;
+                    taken = taken || (!unknown && v == 1);
+                    unknown = unknown || (!taken && v < 0);
+                    if (dead_branch) {
+                        dead.push_back(std::make_pair(br.begin+1, br.end));
                     }
                 }
-                continue;   
             }
 
-            ++t;
+            if (!sure_stack.empty()) {
+                sure_stack.back() = branch_sure[b];
+            }
+            const CondBranch& br = conds.get(b);
+            i = br.active ? i+1 : br.end;
         }
-    }
 
-    //抽取带namespace的宏
-    for (auto it = _g_marco.begin(); it != _g_marco.end(); ++it) {
-        Token& t = *it;
-        if (t.ts.size() > 1 && t.ts[1].val == "namespace") {
-            for (auto it2 = t.ts.begin()+1;it2 != t.ts.end(); ) {
-                Token tt;
-                if (it2->type == CPP_NAME && is_in_marco(it2->val,tt)) {
-                    it2 = t.ts.erase(it2);
-                    for (auto it3 = tt.ts.begin()+1; it3 != tt.ts.end(); ++it3) {
-                        it2 = t.ts.insert(it2, *it3);
-                        ++it2;
-                    }
-                    continue;
-                }
-                ++it2;
-            }
+        //嵌套组的分支在外层组的后续分支之后才记录, 先按位置排序
+        std::sort(dead.begin(), dead.end());
+        int dead_num = 0;
+        for (auto it_d = dead.begin(); it_d != dead.end(); ++it_d) {
+            dead_num += it_d->second - it_d->first;
+        }
+        ts.erase_ranges(dead);
+        if (!dead.empty()) {
+            std::cout << "parse marco: drop " << dead_num << " tokens in " << dead.size() << " inactive branches\n";
         }
     }
 
     //l3 把所有的name为marco的token type改成 marco
-    //   并且展开带namespace的宏
+    //   并且展开带namespace的宏(宏体以namespace或者}开头), 宏体只展开一次, 整个流重建一次
     int idx = 0;
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         std::string file_name = _file_name[idx++];
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
+        TokenStream& ts = lex._ts;
+        std::deque<Token> ts_new;
+        std::vector<Token> expanded;
+        bool changed = false;
         for (auto t = ts.begin(); t != ts.end();) {
-            Token tt;
-            if (t->type == CPP_NAME && is_in_marco(t->val,tt)) {
+            if (t->type == CPP_NAME && _g_marco.find(t->val)) {
                 t->type = CPP_MACRO;
-                if (tt.ts.size() > 1 && (tt.ts[1].val == "namespace" || tt.ts[1].type == CPP_CLOSE_BRACE)) {
+                const std::vector<Token>& body = _g_marco.expand(t->val);
+                if (!body.empty() && (body[0].val == "namespace" || body[0].type == CPP_CLOSE_BRACE)) {
                     //需要展开的宏
-                    t = ts.erase(t);
-                    for (auto it3 = tt.ts.begin()+1; it3 != tt.ts.end(); ++it3) {
-                        t = ts.insert(t, *it3);
-                        ++t;
+                    expanded.clear();
+                    auto t_call = t;
+                    if (_g_marco.expand_at(t_call, token_end(ts), expanded)) {
+                        ts_new.insert(ts_new.end(), expanded.begin(), expanded.end());
+                        t = t_call;
+                        changed = true;
+                        continue;
                     }
-                    continue;
                 }
             } 
+            ts_new.push_back(*t);
             ++t;
         }
+        if (changed) {
+            ts.swap(ts_new);
+        }
     }
 }
 
 void Obfuscator::extract_enum() {
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ++t) {
+        TokenStream& ts = lex._ts;
+        for (auto t = token_begin(ts); t != token_end(ts); ++t) {
             if (t->type == CPP_KEYWORD && t->val == "enum" && (t+1)->type == CPP_NAME) {
                 (t+1)->type = CPP_ENUM;
                 _g_enum.insert((t+1)->val);
@@ -412,8 +688,8 @@ void Obfuscator::extract_enum() {
     }
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ++t) {
+        TokenStream& ts = lex._ts;
+        for (auto t = token_begin(ts); t != token_end(ts); ++t) {
             if (_g_enum.find(t->val) != _g_enum.end()) {
                 t->type = CPP_TYPE;
             }
@@ -509,8 +785,8 @@ void Obfuscator::parse_tempalte_para(
 void Obfuscator::extract_class(
     std::deque<Token>::iterator& t,
     std::deque<Token>::iterator t_begin, 
-    std::deque<Token>::iterator &t_end, Scope scope,
-    std::deque<Token>& ts,
+    std::deque<Token>::iterator &t_end, ScopeID scope,
+    TokenStream& ts,
     bool is_template) {
     //it begin calss
     //it end }
@@ -584,19 +860,7 @@ void Obfuscator::extract_class(
         assert((t+2)->type == CPP_NAME);
         t+=2;
         //增加scope
-        Scope sub;
-        sub.type = 1;
-        sub.father = scope.father;
-        sub.name = cur_c_name;
-        sub.father.push_back(scope);
-        for (auto itc = sub.father.begin(); itc != sub.father.end(); ++itc) {
-           if (!itc->name.empty()) {
-                sub.key += itc->name + "::"; 
-            }
-        }
-    
-        sub.key += sub.name;
-        scope = sub;
+        scope = get_scope(scope, cur_c_name, 1);
         cur_c_name = t->val;
     }
 
@@ -637,7 +901,11 @@ void Obfuscator::extract_class(
     assert(t->type == CPP_CLASS_BEGIN);
 
     if (_g_class.find(cur_c_name) == _g_class.end()) {
-        _g_class[cur_c_name] = {cur_c_name, is_struct, is_template, father, scope, t_paras, t_paras_list};
+        std::map<std::string, TypeRef> tm_paras;
+        for (auto it_p = t_paras.begin(); it_p != t_paras.end(); ++it_p) {
+            tm_paras[it_p->first] = _types.intern(it_p->second);
+        }
+        _g_class[cur_c_name] = {cur_c_name, is_struct, is_template, father, scope, tm_paras, t_paras_list};
     }
     if (_g_class_fn.find(cur_c_name) == _g_class_fn.end()) {
         _g_class_fn[cur_c_name] = std::vector<ClassFunction>();
@@ -695,7 +963,7 @@ void Obfuscator::extract_class(
             t_template = t;
             std::stack<Token> st;
             ++t;
-            while(t->type != CPP_LESS && t != ts.end()) {
+            while(t != ts.end() && t->type != CPP_LESS) {
                 ++t;
             }
             if (t == ts.end()) {
@@ -749,15 +1017,7 @@ void Obfuscator::extract_class(
                 t->type = CPP_CLASS_END;
 
                 //增加scope
-                Scope sub;
-                sub.type = 1;
-                sub.father = scope.father;
-                sub.name = cur_c_name;
-                sub.father.push_back(scope);
-                for (auto itc = sub.father.begin(); itc != sub.father.end(); ++itc) {
-                   sub.key += itc->name + "::"; 
-                }
-                sub.key += sub.name;
+                const ScopeID sub = get_scope(scope, cur_c_name, 1);
 
                 if (next_class_template) {
                     next_class_template = false;
@@ -786,7 +1046,7 @@ void Obfuscator::extract_class(
                 //t->val = "~"+t->val;
                 t->subject = cur_c_name;
                 t->ts.push_back(*(t-1));
-                class_fn.push_back({access, cur_c_name, t->val, std::deque<Token>(), Token()});
+                class_fn.push_back({access, cur_c_name, t->val, std::deque<Token>(), TYPE_OTHER});
 
                 //删除 ~
                 --t;
@@ -805,7 +1065,7 @@ void Obfuscator::extract_class(
                     //肯定是构造函数
                     t->type = CPP_MEMBER_FUNCTION;
                     t->subject = cur_c_name;
-                    class_fn.push_back({access, cur_c_name, t->val, std::deque<Token>(), Token()});
+                    class_fn.push_back({access, cur_c_name, t->val, std::deque<Token>(), TYPE_OTHER});
 
                     ++t;
                     jump_paren(t, ts);
@@ -813,7 +1073,7 @@ void Obfuscator::extract_class(
                     if (t->type == CPP_COLON) {
                         //初始化列表 跳过直至第一个 {
                         ++t;
-                        while(t->type != CPP_OPEN_BRACE && t!=ts.end()) {
+                        while(t != ts.end() && t->type != CPP_OPEN_BRACE) {
                             ++t;
                         }
                         
@@ -835,9 +1095,9 @@ void Obfuscator::extract_class(
                         //初始化列表 是构造函数 跳过直至第一个 {
                         t_may_c->type = CPP_MEMBER_FUNCTION;
                         t_may_c->subject = cur_c_name;
-                        class_fn.push_back({access, cur_c_name, t_may_c->val, std::deque<Token>(), Token()});
+                        class_fn.push_back({access, cur_c_name, t_may_c->val, std::deque<Token>(), TYPE_OTHER});
                         ++t;
-                        while(t->type != CPP_OPEN_BRACE && t!=ts.end()) {
+                        while(t != ts.end() && t->type != CPP_OPEN_BRACE) {
                             ++t;
                         }
                         jump_brace(t, ts);
@@ -846,20 +1106,20 @@ void Obfuscator::extract_class(
                         //构造函数体  是构造函数
                         t_may_c->type = CPP_MEMBER_FUNCTION;
                         t_may_c->subject = cur_c_name;
-                        class_fn.push_back({access, cur_c_name, t_may_c->val, std::deque<Token>(), Token()});
+                        class_fn.push_back({access, cur_c_name, t_may_c->val, std::deque<Token>(), TYPE_OTHER});
                         jump_brace(t, ts);
                         ++t;
                     } else if (t->type == CPP_SEMICOLON) {
                         //构造函数定义  是构造函数
                         t_may_c->type = CPP_MEMBER_FUNCTION;
                         t_may_c->subject = cur_c_name;
-                        class_fn.push_back({access, cur_c_name, t_may_c->val, std::deque<Token>(), Token()});
+                        class_fn.push_back({access, cur_c_name, t_may_c->val, std::deque<Token>(), TYPE_OTHER});
                     } else {
                         //不是构造函数
                         continue;
                     }
                 }
-            } else if(t->type == CPP_NAME && t_n != ts.end() && t_n->type == CPP_OPEN_PAREN) {
+            } else if(t->type == CPP_NAME && t_n->type == CPP_OPEN_PAREN) {
                 //可能是成员函数
                 //std::cout << "may function: " << t->val << std::endl;
                 auto t_may_c = t;
@@ -869,7 +1129,7 @@ void Obfuscator::extract_class(
                 if (t->type == CPP_OPEN_BRACE || t->type == CPP_SEMICOLON || t->val == "const" || t->val == "throw" || (t->type == CPP_EQ && (t+1)->val == "0")) {
                     t_may_c->type = CPP_MEMBER_FUNCTION;
                     t_may_c->subject = cur_c_name;
-                    class_fn.push_back({access, cur_c_name, t_may_c->val, recall_fn_ret(t_may_c), Token()});
+                    class_fn.push_back({access, cur_c_name, t_may_c->val, recall_fn_ret(t_may_c), TYPE_OTHER});
                 } else {
                     //不是成员函数
                     continue;
@@ -885,7 +1145,7 @@ void Obfuscator::extract_class(
                     t = ts.erase(t);//(
                     t = ts.erase(t);//)
                     --t;
-                    class_fn.push_back({access, cur_c_name, t->val, recall_fn_ret(t), Token()});
+                    class_fn.push_back({access, cur_c_name, t->val, recall_fn_ret(t), TYPE_OTHER});
                 } else {
                     //合并到第一个(之前的运算符
                     auto t_op = t;
@@ -895,7 +1155,7 @@ void Obfuscator::extract_class(
                         t = ts.erase(t);
                     }
                     --t;
-                    class_fn.push_back({access, cur_c_name, t->val, recall_fn_ret(t), Token()});
+                    class_fn.push_back({access, cur_c_name, t->val, recall_fn_ret(t), TYPE_OTHER});
                 }
                 update_t_end(t);
                 ++t;
@@ -928,70 +1188,14 @@ void Obfuscator::extract_class() {
         std::string file_name = _file_name[idx++];
         std::cout << "extract class in: " << file_name << std::endl;
 
-        std::deque<Token>& ts = lex._ts;
-        std::deque<Scope> scopes;
-        Scope root_scope;
-        root_scope.type = 0;
-        scopes.push_back(root_scope);
-        Scope* cur_scope = &(scopes.back());
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        TokenStream& ts = lex._ts;
+        ScopeID cur_scope = ROOT_SCOPE;
+        _scopes[ROOT_SCOPE].depth = 0;
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             //scope 
             bool next_class_template = false;
             auto t_template = t;
-            if (t->val=="namespace" &&
-                (t+1)!= ts.end() && (t+1)->type == CPP_NAME &&
-                (t+2)!= ts.end() && (t+2)->type == CPP_OPEN_BRACE) {
-                Scope sub;
-                sub.type = 0;
-                sub.name = (t+1)->val;
-                sub.sb.push(*(t+1));
-                sub.father = scopes;
-                for (auto itc = scopes.begin(); itc != scopes.end(); ++itc) {
-                    if (!itc->name.empty()) {
-                        sub.key += itc->name + "::"; 
-                    }
-                }
-                sub.key += sub.name;
-                
-                scopes.push_back(sub);
-                cur_scope = &scopes.back();
-                t+=3;
-                continue;
-            } else if (t->val=="namespace" && (t+1)->type == CPP_OPEN_BRACE) {
-                // //不可以在匿名域中定义class
-                // ++t;
-                // jump_brace(t, ts);
-                // ++t;
-                // continue;
-                //匿名区域
-                Scope sub;
-                sub.type = 0;
-                sub.name = ANONYMOUS_SCOPE;
-                sub.sb.push(*(t+1));
-                sub.father = scopes;
-                for (auto itc = scopes.begin(); itc != scopes.end(); ++itc) {
-                    if (!itc->name.empty()) {
-                        sub.key += itc->name + "::"; 
-                    }
-                }
-                sub.key += sub.name;
-                
-                scopes.push_back(sub);
-                cur_scope = &scopes.back();
-                t+=2;
-                continue;
-            } else if (t->type == CPP_OPEN_BRACE) {
-                cur_scope->sb.push(*t);
-                ++t;
-                continue;
-            } else if (t->type == CPP_CLOSE_BRACE) {
-                cur_scope->sb.pop();
-                if (!cur_scope->name.empty() && cur_scope->sb.empty()) {
-                    //如果不是默认作用域 则跳出当前作用域
-                    scopes.pop_back();
-                    cur_scope = &scopes.back();
-                }
-                ++t;
+            if (update_scope(t, ts, cur_scope, true)) {
                 continue;
             }
 
@@ -1001,7 +1205,7 @@ void Obfuscator::extract_class() {
                 //找<
                 std::stack<Token> st;
                 ++t;
-                while(t->type != CPP_LESS && t != ts.end()) {
+                while(t != ts.end() && t->type != CPP_LESS) {
                     ++t;
                 }
                 if (t == ts.end()) {
@@ -1071,9 +1275,9 @@ void Obfuscator::extract_class() {
                     assert(t->type == CPP_CLOSE_BRACE || t->type == CPP_CLASS_END);
                     t->type = CPP_CLASS_END;
                     if (next_class_template) {
-                        extract_class(t_template, t_template, t, *cur_scope, ts, true);
+                        extract_class(t_template, t_template, t, cur_scope, ts, true);
                     } else {
-                        extract_class(t_begin, t_begin, t, *cur_scope, ts, false);
+                        extract_class(t_begin, t_begin, t, cur_scope, ts, false);
                     }
                     ++t;
                     continue;
@@ -1093,10 +1297,9 @@ void Obfuscator::extract_class() {
     bool steady = false;
     
     {
-        Scope scope;
-        std::map<std::string, Token> tm_paras;
+        std::map<std::string, TypeRef> tm_paras;
         std::vector<std::string> tm_paras_list;
-        _g_class[THIRD_CLASS] = {THIRD_CLASS, false, false, "", scope, tm_paras, tm_paras_list};
+        _g_class[THIRD_CLASS] = {THIRD_CLASS, false, false, "", ROOT_SCOPE, tm_paras, tm_paras_list};
         _g_class_fn[THIRD_CLASS] = std::vector<ClassFunction>();
         _g_class_variable[THIRD_CLASS] = std::vector<ClassVariable>();
     }
@@ -1167,8 +1370,8 @@ void Obfuscator::extract_class() {
     //解析class struct 的 type
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        TokenStream& ts = lex._ts;
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             bool tm = false;
             if (t->type == CPP_NAME && is_in_class_struct(t->val, tm)) {
                 t->type = CPP_TYPE;
@@ -1178,7 +1381,7 @@ void Obfuscator::extract_class() {
                 } else {
                     //合并模板类型的类或者结构体
                     Token* c_t = &(*t);
-                    if ((t+1) != ts.end() && (t+1)->type == CPP_LESS) {
+                    if ((t+1)->type == CPP_LESS) {
                         std::stack<Token> st; 
                         st.push(*(t+1));  
                         c_t->ts.push_back(*(t+1));
@@ -1213,9 +1416,9 @@ void Obfuscator::extract_typedef() {
     //抽取typedef的类型(注意作用域)
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
+        TokenStream& ts = lex._ts;
 
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
 
             //---------------------------------------------------------//
             //common function
@@ -1224,7 +1427,7 @@ void Obfuscator::extract_typedef() {
                 td = *t;
                 td.ts.clear();
                 ++t;
-                while(!((t->type == CPP_NAME||t->type == CPP_TYPE) && (t+1)!=ts.end() && (t+1)->type == CPP_SEMICOLON)) {
+                while(!Pattern<Is<CPP_NAME, CPP_TYPE>, Is<CPP_SEMICOLON>>::match(t, ts)) {
                     td.ts.push_back(*t);
                     ++t;
                 }
@@ -1262,34 +1465,23 @@ void Obfuscator::extract_typedef() {
         }
     }
 
-    //内部展开typedef
-    bool steady = false;
-    while(!steady) {
-        steady = true;
-        for (auto it = _typedef_map.begin(); it != _typedef_map.end(); ++it) {
-            for (auto it2 = it->second.ts.begin(); it2 != it->second.ts.end(); ) {
-                auto it3 = _typedef_map.find(it2->val);
-                if (it3 != _typedef_map.end()) {
-                    //展开
-                    it2 = it->second.ts.erase(it2);
-                    for (auto it4 = it3->second.ts.begin(); it4 != it3->second.ts.end(); ++it4) {
-                        it2 = it->second.ts.insert(it2, *it4);
-                        ++it2;
-                    }
-                    steady = false;
-                    continue;
-                }
-                ++it2;
-            }
-        }
+    //内部展开typedef, 每个typedef只展开一次
+    std::map<std::string, int> status;
+    for (auto it = _typedef_map.begin(); it != _typedef_map.end(); ++it) {
+        resolve_typedef(it->first, status);
+    }
+
+    //计算typedef的规范类型, 要做容器分析, 只有full才需要
+    if (_level == LEVEL_FULL) {
+        build_typedef_canonical();
     }
 
     //展开所有的typedef
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
+        TokenStream& ts = lex._ts;
 
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             Token tt;
             if (t->val == "typedef") {
                 //跳过typedef
@@ -1299,6 +1491,14 @@ void Obfuscator::extract_typedef() {
                 }
                 continue;
             } else if (t->type == CPP_NAME && is_in_typedef(t->val, tt)) {
+                if (tt.type == CPP_TYPE) {
+                    //规范类型直接替换, 不需要再分析容器
+                    const int loc = t->loc;
+                    *t = tt;
+                    t->loc = loc;
+                    ++t;
+                    continue;
+                }
                 t = ts.erase(t);
                 for (auto it2 = tt.ts.begin(); it2 != tt.ts.end(); ++it2) {
                     t = ts.insert(t, *it2);
@@ -1312,11 +1512,63 @@ void Obfuscator::extract_typedef() {
     }
 }
 
+bool Obfuscator::resolve_typedef(const std::string& name, std::map<std::string, int>& status) {
+    //status: 1 正在展开 2 已经展开
+    auto it_s = status.find(name);
+    if (it_s != status.end()) {
+        if (it_s->second == 1) {
+            std::cerr << "typedef cycle: " << name << std::endl;
+            return false;
+        }
+        return true;
+    }
+    status[name] = 1;
+
+    Token& td = _typedef_map.find(name)->second;
+    for (auto it = td.ts.begin(); it != td.ts.end(); ) {
+        auto it_sub = _typedef_map.find(it->val);
+        if (it_sub != _typedef_map.end() && resolve_typedef(it->val, status)) {
+            //展开
+            it = td.ts.erase(it);
+            for (auto it2 = it_sub->second.ts.begin(); it2 != it_sub->second.ts.end(); ++it2) {
+                it = td.ts.insert(it, *it2);
+                ++it;
+            }
+            continue;
+        }
+        ++it;
+    }
+
+    status[name] = 2;
+    return true;
+}
+
+void Obfuscator::build_typedef_canonical() {
+    //把typedef展开后的容器和* &合并成一个CPP_TYPE, 只计算一次
+    _typedef_canonical.clear();
+    for (auto it = _typedef_map.begin(); it != _typedef_map.end(); ++it) {
+        TokenStream tts;
+        tts = it->second.ts;
+        //和文件的token流一样首尾加上哨兵, 分析完再去掉
+        for (int i = 0; i < TOKEN_PAD; ++i) {
+            tts.push_front({CPP_EOF,"",-1});
+            tts.push_back({CPP_EOF,"",-1});
+        }
+        extract_container(tts);
+        combine_type_with_multi_and_rm_const(tts);
+        tts.erase(token_end(tts), tts.end());
+        tts.erase(tts.begin(), token_begin(tts));
+        if (tts.size() == 1 && tts[0].type == CPP_TYPE) {
+            _typedef_canonical[it->first] = tts[0];
+        }
+    }
+}
+
 void Obfuscator::extract_decltype() {
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        TokenStream& ts = lex._ts;
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             if (t->val == "decltype") {
                 assert((t+1)->type == CPP_OPEN_PAREN);
                 ++t;
@@ -1345,7 +1597,7 @@ void Obfuscator::extract_decltype() {
     }
 }
 
-void Obfuscator::extract_container() {
+void Obfuscator::extract_container(TokenStream& ts) {
     //TODO typedef已经连接了可能存在的container,需要重新分析
 
     //分析的容器如下
@@ -1378,380 +1630,371 @@ void Obfuscator::extract_container() {
 
     std::string ns = "std"; 
 
-    int idx = 0;
-    for (auto it = _lex.begin(); it != _lex.end(); ++it) {
-        Lex& lex = *(*it);
-        std::string file_name = _file_name[idx++];
-        std::cout << "extract container: " << file_name << std::endl;
-        
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
-            auto t_n = t+1;//::
-            auto t_nn = t+2;//container
-            auto t_nnn = t+3;//<
-
-            if (t->val == ns && t_n != ts.end() && t_nn != ts.end() && t_nnn != ts.end() &&
-                t_n->type == CPP_SCOPE && std_container.find(t_nn->val) != std_container.end() && t_nnn->type == CPP_LESS) {
-                //找到std的源头, 第一个容器
-                std::stack<Token*> stt;//stack token type
-                std::stack<Token> st_scope; //<>
-                
-                Token* root_scope = &(*t);
-                root_scope->val = t_nn->val;
-                root_scope->subject = ns;
-                root_scope->type = CPP_TYPE;
-                stt.push(root_scope);
-                Token* cur_scope = stt.top();
-                st_scope.push(*t_nnn); //<
-
-                int step = 0;
-
-                t+=4;
-                step +=3;//:: container <
-
-                while(!stt.empty() && t != ts.end()) {
-                    auto t_n = t+1;//::
-                    auto t_nn = t+2;//container
-                    auto t_nnn = t+3;//<
-                    if (t->val == ns && t_n != ts.end() && t_n->type == CPP_SCOPE &&
-                        t_nn != ts.end() && std_container.find(t_nn->val) != std_container.end() &&
-                        t_nnn != ts.end() && t_nnn->type == CPP_LESS) {
-                        //容器的嵌套
-                        const std::string cur_name = t_nn->val;
-                        if (std_container.find(cur_name) != std_container.end()) {
-                            Token sub;
-                            sub.val = cur_name;
-                            sub.type = CPP_TYPE;
-                            sub.subject = ns;
-                            cur_scope->ts.push_back(sub);
-                            cur_scope = &(cur_scope->ts.back());//进入到下一个容器中
-                            st_scope.push(*t_nnn);
-                            stt.push(cur_scope);
-
-                            step += 4; // std :: container <
-                            t+=4;
-                        } else {
-                            //TODO 如何处理 ?
-                            std::cout << "unsupported std container: " << cur_name << "\n";
-                            ++t;
-                            continue;
-                        }                        
-                    } else if (t->type == CPP_TYPE) {
-                        //已知类型
-                        //查找是不是模板类
-                        cur_scope->ts.push_back(*t);
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_TYPE && t_n->type == CPP_LESS) {
-                        //TODO 应该也是其他模块的模板, 而且是没有被解析的
-                        std::cout << "invalid template name: " << t->val << std::endl; 
-                        assert(false);
-                    } else if (t->type == CPP_NAME) {
-                        //TODO 应该是其他模块类型 直接合并
-                        std::cout << "invalid 3th type: " << t->val << std::endl; 
-                        //合并模板
-                        std::stack<Token> tss;
-                        Token tt = *t;
-                        ++t;
-                        ++step;
-                        while(t->type != CPP_GREATER) {
-                            tt.ts.push_back(*t);
-                            if (t->type == CPP_LESS) {
-                                tss.push(*t);
-                                ++t;
-                                ++step;
-                            } else {
-                                ++t;
-                                ++step;
-                            }
-
-                            if (t->type == CPP_GREATER && !tss.empty()) {
-                                tt.ts.push_back(*t);
-                                tss.pop();
-                                ++t;
-                                ++step;
-                                continue;
-                            } else if (t->type == CPP_GREATER && tss.empty()) {
-                                tt.ts.push_back(*t);
-                                --t;
-                                --step;
-                                break;
-                            }
-                        }
-                        
-                        cur_scope->ts.push_back(tt);
-                        continue;
-                    } else if(t->type == CPP_OPEN_SQUARE || t->type == CPP_CLOSE_SQUARE ) {
-                        //unique_ptr
-                        cur_scope->ts.push_back(*t);
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_COMMA) {
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_MULT) {
-                        //指针
-                        cur_scope->ts.push_back(*t);
+    //容器后面的token先记下, 每一趟结束后一起删掉
+    std::vector<std::pair<int, int>> drop;
+    for (auto t = token_begin(ts); t != token_end(ts); ) {
+        auto t_nn = t+2;//container
+        auto t_nnn = t+3;//<
+
+        if (Pattern<Any, Is<CPP_SCOPE>, Any, Is<CPP_LESS>>::match(t, ts) && 
+            t->val == ns && std_container.find(t_nn->val) != std_container.end()) {
+            //找到std的源头, 第一个容器
+            std::stack<Token*> stt;//stack token type
+            std::stack<Token> st_scope; //<>
+            
+            Token* root_scope = &(*t);
+            root_scope->val = t_nn->val;
+            root_scope->subject = ns;
+            root_scope->type = CPP_TYPE;
+            stt.push(root_scope);
+            Token* cur_scope = stt.top();
+            st_scope.push(*t_nnn); //<
+
+            int step = 0;
+
+            t+=4;
+            step +=3;//:: container <
+
+            while(!stt.empty() && t != token_end(ts)) {
+                auto t_n = t+1;//::
+                auto t_nn = t+2;//container
+                auto t_nnn = t+3;//<
+                if (Pattern<Any, Is<CPP_SCOPE>, Any, Is<CPP_LESS>>::match(t, ts) && 
+                    t->val == ns && std_container.find(t_nn->val) != std_container.end()) {
+                    //容器的嵌套
+                    const std::string cur_name = t_nn->val;
+                    if (std_container.find(cur_name) != std_container.end()) {
+                        Token sub;
+                        sub.val = cur_name;
+                        sub.type = CPP_TYPE;
+                        sub.subject = ns;
+                        cur_scope->ts.push_back(sub);
+                        cur_scope = &(cur_scope->ts.back());//进入到下一个容器中
+                        st_scope.push(*t_nnn);
+                        stt.push(cur_scope);
+
+                        step += 4; // std :: container <
+                        t+=4;
+                    } else {
+                        //TODO 如何处理 ?
+                        std::cout << "unsupported std container: " << cur_name << "\n";
                         ++t;
-                        ++step;
                         continue;
-                    } else if (t->type == CPP_SCOPE) {
-                        //域或者迭代器
-                        if ((t+1)->val == "iterator" || (t+1)->val == "const_iterator") {
-                            //迭代器
-                            assert(cur_scope->ts.size() == 1);
-                            Token t_iter;
-                            t_iter.type = CPP_TYPE;
-                            t_iter.val = "iterator";
-                            t_iter.ts.push_back(std::move(cur_scope->ts[0]));
-                            cur_scope->ts.clear();
-                            cur_scope->ts.push_back(t_iter);
-                            t+=2;
-                            step+=2;
-                            continue;
+                    }                        
+                } else if (t->type == CPP_TYPE) {
+                    //已知类型
+                    //查找是不是模板类
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_TYPE && t_n->type == CPP_LESS) {
+                    //TODO 应该也是其他模块的模板, 而且是没有被解析的
+                    std::cout << "invalid template name: " << t->val << std::endl; 
+                    assert(false);
+                } else if (t->type == CPP_NAME) {
+                    //TODO 应该是其他模块类型 直接合并
+                    std::cout << "invalid 3th type: " << t->val << std::endl; 
+                    //合并模板
+                    std::stack<Token> tss;
+                    Token tt = *t;
+                    ++t;
+                    ++step;
+                    while(t->type != CPP_GREATER) {
+                        tt.ts.push_back(*t);
+                        if (t->type == CPP_LESS) {
+                            tss.push(*t);
+                            ++t;
+                            ++step;
                         } else {
-                            cur_scope->ts.push_back(*t);
+                            ++t;
+                            ++step;
+                        }
+
+                        if (t->type == CPP_GREATER && !tss.empty()) {
+                            tt.ts.push_back(*t);
+                            tss.pop();
                             ++t;
                             ++step;
                             continue;
+                        } else if (t->type == CPP_GREATER && tss.empty()) {
+                            tt.ts.push_back(*t);
+                            --t;
+                            --step;
+                            break;
                         }
-                    } else if (t->type == CPP_OPEN_PAREN || t->type == CPP_CLOSE_PAREN) {
-                        //function 会带()
-                        cur_scope->ts.push_back(*t);
-                        ++t;
-                        ++step;
+                    }
+                    
+                    cur_scope->ts.push_back(tt);
+                    continue;
+                } else if(t->type == CPP_OPEN_SQUARE || t->type == CPP_CLOSE_SQUARE ) {
+                    //unique_ptr
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_COMMA) {
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_MULT) {
+                    //指针
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_SCOPE) {
+                    //域或者迭代器
+                    if ((t+1)->val == "iterator" || (t+1)->val == "const_iterator") {
+                        //迭代器
+                        assert(cur_scope->ts.size() == 1);
+                        Token t_iter;
+                        t_iter.type = CPP_TYPE;
+                        t_iter.val = "iterator";
+                        t_iter.ts.push_back(std::move(cur_scope->ts[0]));
+                        cur_scope->ts.clear();
+                        cur_scope->ts.push_back(t_iter);
+                        t+=2;
+                        step+=2;
                         continue;
-                    } else if (t->type == CPP_GREATER) {
-                        //>
-                        //jump out scope
-                        assert(st_scope.top().type == CPP_LESS); 
-                        st_scope.pop();
-                        stt.pop();
-                        cur_scope = stt.empty() ? nullptr : stt.top();
+                    } else {
+                        cur_scope->ts.push_back(*t);
                         ++t;
                         ++step;
                         continue;
-                    } else {
-                        std::cout << "invalid name 2: " << t->val << std::endl; 
-                        assert(false);
-                        ++t;
                     }
-                }   
-
-                //erase 
-                t-=step;
-                while (step>0) {
-                    t = ts.erase(t);
-                    --step;
+                } else if (t->type == CPP_OPEN_PAREN || t->type == CPP_CLOSE_PAREN) {
+                    //function 会带()
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_GREATER) {
+                    //>
+                    //jump out scope
+                    assert(st_scope.top().type == CPP_LESS); 
+                    st_scope.pop();
+                    stt.pop();
+                    cur_scope = stt.empty() ? nullptr : stt.top();
+                    ++t;
+                    ++step;
+                    continue;
+                } else {
+                    std::cout << "invalid name 2: " << t->val << std::endl; 
+                    assert(false);
+                    ++t;
                 }
+            }   
 
-                //std::cout << "t-1: " << (t-1)->val << std::endl;
+            //erase 
+            const int pos = t - ts.begin();
+            drop.push_back(std::make_pair(pos-step, pos));
 
-            } else {
-                ++t;
-            }
+            //std::cout << "t-1: " << (t-1)->val << std::endl;
+
+        } else {
+            ++t;
         }
     }
 
+    ts.erase_ranges(drop);
+    drop.clear();
+
     std_container.clear();
     std_container.insert("shared_ptr");
     ns = "boost"; 
 
-    for (auto it = _lex.begin(); it != _lex.end(); ++it) {
-        Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
-            auto t_n = t+1;//::
-            auto t_nn = t+2;//container
-            auto t_nnn = t+3;//<
-
-            if (t->val == ns && t_n != ts.end() && t_nn != ts.end() && t_nnn != ts.end() &&
-                t_n->type == CPP_SCOPE && std_container.find(t_nn->val) != std_container.end() && t_nnn->type == CPP_LESS) {
-                //找到std的源头, 第一个容器
-                std::stack<Token*> stt;//stack token type
-                std::stack<Token> st_scope; //<>
-                
-                Token* root_scope = &(*t);
-                root_scope->val = t_nn->val;
-                root_scope->subject = ns;
-                root_scope->type = CPP_TYPE;
-                stt.push(root_scope);
-                Token* cur_scope = stt.top();
-                st_scope.push(*t_nnn); //<
-
-                int step = 0;
-
-                t+=4;
-                step +=3;//:: container <
-
-                while(!stt.empty() && t != ts.end()) {
-                    auto t_n = t+1;//::
-                    auto t_nn = t+2;//container
-                    auto t_nnn = t+3;//<
-                    if (t->val == ns && t_n != ts.end() && t_nn != ts.end() && t_nnn != ts.end() && 
-                        t_n->type == CPP_SCOPE && t_nnn->type == CPP_LESS) {
-                        //容器的嵌套
-                        const std::string cur_name = t_nn->val;
-                        if (std_container.find(cur_name) != std_container.end()) {
-                            Token sub;
-                            sub.val = cur_name;
-                            sub.type = CPP_TYPE;
-                            sub.subject = ns;
-                            cur_scope->ts.push_back(sub);
-                            cur_scope = &(cur_scope->ts.back());//进入到下一个容器中
-                            st_scope.push(*t_nnn);
-                            stt.push(cur_scope);
-
-                            step += 4; // std :: container <
-                            t+=4;
-                        } else {
-                            //TODO 如何处理 ?
-                            std::cout << "unsupported std container: " << cur_name << "\n";
-                            ++t;
-                            continue;
-                        }                        
-                    } else if (t->type == CPP_GREATER) {
-                        //>
-                        //jump out scope
-                        assert(st_scope.top().type == CPP_LESS); 
-                        st_scope.pop();
-                        stt.pop();
-                        cur_scope = stt.empty() ? nullptr : stt.top();
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_TYPE) {
-                        //已知类型
-                        cur_scope->ts.push_back(*t);
+    for (auto t = token_begin(ts); t != token_end(ts); ) {
+        auto t_nn = t+2;//container
+        auto t_nnn = t+3;//<
+
+        if (Pattern<Any, Is<CPP_SCOPE>, Any, Is<CPP_LESS>>::match(t, ts) && 
+            t->val == ns && std_container.find(t_nn->val) != std_container.end()) {
+            //找到std的源头, 第一个容器
+            std::stack<Token*> stt;//stack token type
+            std::stack<Token> st_scope; //<>
+            
+            Token* root_scope = &(*t);
+            root_scope->val = t_nn->val;
+            root_scope->subject = ns;
+            root_scope->type = CPP_TYPE;
+            stt.push(root_scope);
+            Token* cur_scope = stt.top();
+            st_scope.push(*t_nnn); //<
+
+            int step = 0;
+
+            t+=4;
+            step +=3;//:: container <
+
+            while(!stt.empty() && t != token_end(ts)) {
+                auto t_n = t+1;//::
+                auto t_nn = t+2;//container
+                auto t_nnn = t+3;//<
+                if (Pattern<Any, Is<CPP_SCOPE>, Any, Is<CPP_LESS>>::match(t, ts) && t->val == ns) {
+                    //容器的嵌套
+                    const std::string cur_name = t_nn->val;
+                    if (std_container.find(cur_name) != std_container.end()) {
+                        Token sub;
+                        sub.val = cur_name;
+                        sub.type = CPP_TYPE;
+                        sub.subject = ns;
+                        cur_scope->ts.push_back(sub);
+                        cur_scope = &(cur_scope->ts.back());//进入到下一个容器中
+                        st_scope.push(*t_nnn);
+                        stt.push(cur_scope);
+
+                        step += 4; // std :: container <
+                        t+=4;
+                    } else {
+                        //TODO 如何处理 ?
+                        std::cout << "unsupported std container: " << cur_name << "\n";
                         ++t;
-                        ++step;
                         continue;
-                    } else if (t->type == CPP_TYPE && t_n->type == CPP_LESS) {
-                        //TODO 应该也是其他模块的模板, 而且是没有被解析的
-                        std::cout << "invalid template name: " << t->val << std::endl; 
-                        assert(false);
-                    } else if (t->type == CPP_NAME) {
-                        //TODO 应该是其他模块类型 直接合并
+                    }                        
+                } else if (t->type == CPP_GREATER) {
+                    //>
+                    //jump out scope
+                    assert(st_scope.top().type == CPP_LESS); 
+                    st_scope.pop();
+                    stt.pop();
+                    cur_scope = stt.empty() ? nullptr : stt.top();
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_TYPE) {
+                    //已知类型
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_TYPE && t_n->type == CPP_LESS) {
+                    //TODO 应该也是其他模块的模板, 而且是没有被解析的
+                    std::cout << "invalid template name: " << t->val << std::endl; 
+                    assert(false);
+                } else if (t->type == CPP_NAME) {
+                    //TODO 应该是其他模块类型 直接合并
 
-                        std::cout << "invalid template name 2: " << t->val << std::endl; 
-                        //合并模板
-                        std::stack<Token> tss;
-                        Token tt = *t;
-                        ++t;
-                        ++step;
-                        while(t->type != CPP_GREATER && t->type != CPP_COMMA) {
-                            tt.ts.push_back(*t);
-                            if (t->type == CPP_LESS) {
-                                tss.push(*t);
-                                ++t;
-                                ++step;
-                                continue;
-                            } else {
-                                ++t;
-                                ++step;
-                            }
+                    std::cout << "invalid template name 2: " << t->val << std::endl; 
+                    //合并模板
+                    std::stack<Token> tss;
+                    Token tt = *t;
+                    ++t;
+                    ++step;
+                    while(t->type != CPP_GREATER && t->type != CPP_COMMA) {
+                        tt.ts.push_back(*t);
+                        if (t->type == CPP_LESS) {
+                            tss.push(*t);
+                            ++t;
+                            ++step;
+                            continue;
+                        } else {
+                            ++t;
+                            ++step;
+                        }
 
-                            if (t->type == CPP_GREATER && !tss.empty()) {
-                                tss.pop();
-                                ++t;
-                                ++step;
-                                continue;
-                            } else if (t->type == CPP_GREATER && tss.empty()) {
-                                --t;
-                                --step;
-                                break;
-                            }
+                        if (t->type == CPP_GREATER && !tss.empty()) {
+                            tss.pop();
+                            ++t;
+                            ++step;
+                            continue;
+                        } else if (t->type == CPP_GREATER && tss.empty()) {
+                            --t;
+                            --step;
+                            break;
                         }
-                        
-                        cur_scope->ts.push_back(tt);
-                        continue;
-                    } else if(t->type == CPP_OPEN_SQUARE || t->type == CPP_CLOSE_SQUARE ) {
-                        //unique_ptr
-                        cur_scope->ts.push_back(*t);
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_COMMA) {
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_MULT) {
-                        //指针
-                        cur_scope->ts.push_back(*t);
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_SCOPE) {
-                        //域
-                        cur_scope->ts.push_back(*t);
-                        ++t;
-                        ++step;
-                        continue;
-                    } else if (t->type == CPP_OPEN_PAREN || t->type == CPP_CLOSE_PAREN) {
-                        //function 会带()
-                        cur_scope->ts.push_back(*t);
-                        ++t;
-                        ++step;
-                        continue;
-                    } else {
-                        std::cout << "invalid name 2: " << t->val << std::endl; 
-                        assert(false);
-                        ++t;
                     }
-                }   
-
-                //erase 
-                t-=step;
-                while (step>0) {
-                    t = ts.erase(t);
-                    --step;
+                    
+                    cur_scope->ts.push_back(tt);
+                    continue;
+                } else if(t->type == CPP_OPEN_SQUARE || t->type == CPP_CLOSE_SQUARE ) {
+                    //unique_ptr
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_COMMA) {
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_MULT) {
+                    //指针
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_SCOPE) {
+                    //域
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else if (t->type == CPP_OPEN_PAREN || t->type == CPP_CLOSE_PAREN) {
+                    //function 会带()
+                    cur_scope->ts.push_back(*t);
+                    ++t;
+                    ++step;
+                    continue;
+                } else {
+                    std::cout << "invalid name 2: " << t->val << std::endl; 
+                    assert(false);
+                    ++t;
                 }
+            }   
 
-                //std::cout << "t-1: " << (t-1)->val << std::endl;
+            //erase 
+            const int pos = t - ts.begin();
+            drop.push_back(std::make_pair(pos-step, pos));
 
-            } else {
-                ++t;
-            }
+            //std::cout << "t-1: " << (t-1)->val << std::endl;
+
+        } else {
+            ++t;
         }
     }
 
+    ts.erase_ranges(drop);
+    drop.clear();
+
     //合并stl 迭代器
+    for (auto t = token_begin(ts); t != token_end(ts); ) {
+        auto t_nn = t+2;
+        if (Pattern<Is<CPP_TYPE>, Is<CPP_SCOPE>, Either<Kw<KwIterator>, Kw<KwConstIterator>>>::match(t, ts)) {
+            //合并
+            t_nn->type = CPP_TYPE;
+            t_nn->val = "iterator";
+            t_nn->ts.clear();
+            t_nn->ts.push_back(*t);
+            const int pos = t - ts.begin();
+            drop.push_back(std::make_pair(pos, pos+2));//del container ::
+            t += 3;
+        } else {
+            ++t;
+        } 
+    }
+    ts.erase_ranges(drop);
+}
+
+void Obfuscator::extract_container() {
+    int idx = 0;
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ) {
-            auto t_n = t+1;
-            auto t_nn = t+2;
-            if (t->type == CPP_TYPE && t_n != ts.end() && t_nn != ts.end() &&
-                t_n->type == CPP_SCOPE && (t_nn->val == "iterator" || t_nn->val == "const_iterator")) {
-                //合并
-                t_nn->type = CPP_TYPE;
-                t_nn->val = "iterator";
-                t_nn->ts.clear();
-                t_nn->ts.push_back(*t);
-                t = ts.erase(t);//del container
-                t = ts.erase(t);//del ::
-                ++t;
-            } else {
-                ++t;
-            } 
-        }
-    } 
+        std::string file_name = _file_name[idx++];
+        std::cout << "extract container: " << file_name << std::endl;
+        extract_container(lex._ts);
+    }
 }
 
 static ScopeType parse_scope(std::string& scope_name, 
     std::deque<Token>::iterator t_begin, 
     std::deque<Token>::iterator t_end,
-    const std::deque<Token>& ts) {
+    const TokenStream& ts) {
     ScopeType scope;
     scope.scope = scope_name;
     auto t = t_begin;
     ++t;
     while(t < t_end) {
-        if ((t->type == CPP_NAME || t->type == CPP_TYPE) && (t+1)!=ts.end() && (t+1)->type == CPP_OPEN_BRACE) {
+        if (Pattern<Is<CPP_NAME, CPP_TYPE>, Is<CPP_OPEN_BRACE>>::match(t, ts)) {
             //sub scope
             std::string sub_scope_name = t->val;
             ++t;
@@ -1784,10 +2027,11 @@ void Obfuscator::extract_extern_type() {
             break;
         }
     }
+    lex.seal_token();
 
-    std::deque<Token>& ts = lex._ts;
+    TokenStream& ts = lex._ts;
     std::map<std::string, ScopeType> scopes;
-    for (auto t = ts.begin(); t != ts.end(); ) { 
+    for (auto t = token_begin(ts); t != token_end(ts); ) { 
         if(t->type == CPP_BR) {
             t = ts.erase(t);
             continue;
@@ -1796,8 +2040,8 @@ void Obfuscator::extract_extern_type() {
         }
     }
 
-    for (auto t = ts.begin(); t != ts.end(); ) {
-        if ((t->type == CPP_NAME || t->type == CPP_TYPE) && (t+1)!=ts.end() && (t+1)->type == CPP_OPEN_BRACE) {
+    for (auto t = token_begin(ts); t != token_end(ts); ) {
+        if (Pattern<Is<CPP_NAME, CPP_TYPE>, Is<CPP_OPEN_BRACE>>::match(t, ts)) {
             //找到一个scope
             std::string s_name = t->val;
             ++t;
@@ -1820,14 +2064,14 @@ void Obfuscator::extract_extern_type() {
 
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
+        TokenStream& ts = lex._ts;
 
         //using只对当前文件后续的内容有效
         //TODO 这里忽略函数作用域的using
         std::map<std::string, ScopeType> using_scope;
         std::set<std::string> using_types;
 
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
 
             //---------------------------------------------------------//
             //common function
@@ -1840,11 +2084,6 @@ void Obfuscator::extract_extern_type() {
                 auto t_n = t+1;
                 auto t_nn = t+2;
                 auto t_nnn = t+3;
-                if (t_n == ts.end() || t_nn == ts.end()) {
-                    std::cerr << "std scope err\n";
-                    ++t;
-                    return;
-                }
 
                 //std::cout << t_n->val << std::endl;
 
@@ -1852,7 +2091,7 @@ void Obfuscator::extract_extern_type() {
                     auto it_sub_scope = last_scope->sub_scope.find(t_nn->val);
                     auto it_type = last_scope->types.find(t_nn->val);
 
-                    if (it_sub_scope != last_scope->sub_scope.end() && it_type != last_scope->types.end() && t_nnn != ts.end() && t_nnn->type == CPP_SCOPE) {
+                    if (it_sub_scope != last_scope->sub_scope.end() && it_type != last_scope->types.end() && t_nnn->type == CPP_SCOPE) {
                         ts_to_be_type.push_back(*t_n);//::
                         ts_to_be_type.push_back(*t_nn);//type
                         ts_to_be_type.back().subject = last_scope->scope;
@@ -1941,13 +2180,12 @@ void Obfuscator::extract_extern_type() {
 
 
             //只处理文件类型的using, 不处理函数内部的using
-            if (t->val == "using" && (t+1)!= ts.end() && 
-                (t+2)!= ts.end() && (t+2)->type == CPP_EQ) {
+            if (t->val == "using" && (t+2)->type == CPP_EQ) {
                 //using x = xx;
                 using_types.insert((t+1)->val);
                 ++t;
                 continue;
-            } else if (t->val == "using" && (t+1)!= ts.end() && (t+1)->val == "namespace") {
+            } else if (t->val == "using" && (t+1)->val == "namespace") {
                 ScopeType cst;
                 t+=2;
                 auto t_s = scopes.find(t->val);
@@ -1988,30 +2226,32 @@ void Obfuscator::extract_extern_type() {
     }
 }
 
+void Obfuscator::combine_type_with_multi_and_rm_const(TokenStream& ts) {
+    for (auto t = token_begin(ts); t != token_end(ts); ) {    
+        //conbine type with * &
+        if (t->type == CPP_TYPE) {
+            if ((t-1)->val == "const") {
+                //去除const
+                --t;
+                t = ts.erase(t);
+            }
+            auto t_n = t+1;
+            if (t_n->type == CPP_MULT || t_n->type == CPP_AND) {
+                t->ts.push_back(*t_n);
+                t++;
+                t = ts.erase(t);
+                continue;
+            }
+        }
+        ++t;
+    }
+}
+
 void Obfuscator::combine_type_with_multi_and_rm_const() {
     //extract class member & function ret
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
-
-        for (auto t = ts.begin(); t != ts.end(); ) {    
-            //conbine type with * &
-            if (t->type == CPP_TYPE) {
-                if ((t-1)->val == "const") {
-                    //去除const
-                    --t;
-                    t = ts.erase(t);
-                }
-                auto t_n = t+1;
-                if (t_n!=ts.end() && (t_n->type == CPP_MULT || t_n->type == CPP_AND)) {
-                    t->ts.push_back(*t_n);
-                    t++;
-                    t = ts.erase(t);
-                    continue;
-                }
-            }
-            ++t;
-        }
+        combine_type_with_multi_and_rm_const(lex._ts);
     }
 }
 void Obfuscator::extract_class_member (
@@ -2019,10 +2259,10 @@ void Obfuscator::extract_class_member (
     std::deque<Token>::iterator& t, 
     std::deque<Token>::iterator t_begin, 
     std::deque<Token>::iterator t_end, 
-    std::deque<Token>& ts,
+    TokenStream& ts,
     bool is_template) {
 
-    std::map<std::string, Token> tm_paras;
+    std::map<std::string, TypeRef> tm_paras;
     if (is_template) {
         tm_paras = get_template_class_type_paras(cur_c_name);
     }
@@ -2081,10 +2321,11 @@ void Obfuscator::extract_class_member (
         CHECK_MEMBER_VARIABLE_END:
             if (t->type == CPP_SEMICOLON) {
                 //之前的都是成员变量
+                const TypeRef t_type_id = _types.intern(t_type);
                 for (auto it_to_be_m=to_be_m.begin(); it_to_be_m!=to_be_m.end(); ++it_to_be_m) {
                     (*it_to_be_m)->type = CPP_MEMBER_VARIABLE;
                     (*it_to_be_m)->ts.push_back(t_type);
-                    class_variable.push_back({cur_c_name, (*it_to_be_m)->val, t_type});
+                    class_variable.push_back({cur_c_name, (*it_to_be_m)->val, t_type_id});
                 }
             } else {
                 if (t->type == CPP_OPEN_SQUARE) {
@@ -2116,7 +2357,7 @@ void Obfuscator::extract_class_member (
                 bool is_virtual = (t-2)->val == "virtual" || (t-3)->val == "virtual";
                 for (auto it_fn = it_fc->second.begin(); it_fn != it_fc->second.end(); ++it_fn) {
                     if (it_fn->fn_name == t->val) {
-                        it_fn->ret = *(t-1);
+                        it_fn->ret = _types.intern(*(t-1));
                         it_fn->is_virtual = is_virtual;
                         //这里不直接返回,是为了将重载的其他函数的ret也设置了
                         // ++t;
@@ -2142,11 +2383,11 @@ void Obfuscator::extract_class_member() {
     int idx = 0;
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
+        TokenStream& ts = lex._ts;
         std::string file_name = _file_name[idx++];
         std::cout << "extract class member variable: " << file_name << std::endl;
         std::string cur_c_name;
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             if (t->type == CPP_CLASS) {
                 cur_c_name = t->val;
                 ++t;
@@ -2167,19 +2408,13 @@ void Obfuscator::extract_class_member() {
     idx = 0;
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        std::deque<Token>& ts = lex._ts;
+        TokenStream& ts = lex._ts;
         std::string file_name = _file_name[idx++];
         std::cout << "extract class function: " << file_name << std::endl;
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             auto t_n = t+1;//type: class
-            auto t_nn = t+2;//::
             auto t_nnn = t+3;//function
-            if (t_n == ts.end() || t_nn == ts.end() || t_nnn == ts.end()) {
-                ++t;
-                continue;
-            }
-
-            if (t_n->type == CPP_TYPE && t_nn->type == CPP_SCOPE && (t_nnn->type == CPP_NAME || t_nnn->type == CPP_TYPE || t_nnn->val == "operator")) {
+            if (Pattern<Any, Is<CPP_TYPE>, Is<CPP_SCOPE>, Either<Is<CPP_NAME, CPP_TYPE>, Kw<KwOperator>>>::match(t, ts)) {
                 bool tm=false;
 
                 if (t_nnn->val == "operator") {
@@ -2238,8 +2473,7 @@ void Obfuscator::extract_class_member() {
                 } 
                 t+= 3;
                 continue;
-            } else if (t_n->type == CPP_TYPE && t_nn->type == CPP_SCOPE && t_nnn->type == CPP_COMPL &&
-                (t_nnn+1) != ts.end() && (t_nnn+1)->type == CPP_TYPE) {
+            } else if (Pattern<Any, Is<CPP_TYPE>, Is<CPP_SCOPE>, Is<CPP_COMPL>, Is<CPP_TYPE>>::match(t, ts)) {
                 //析构函数
                 bool tm=false;
                 if (t_n->val == (t_nnn+1)->val && is_in_class_struct(t_n->val, tm)) {
@@ -2342,50 +2576,11 @@ void Obfuscator::extract_global_var_fn() {
 
         std::cout << "extract global var fn : " << file_name << std::endl;
 
-        std::deque<Token>& ts = lex._ts;
-        std::deque<Scope> scopes;
-        Scope root_scope;
-        root_scope.type = 0;
-        scopes.push_back(root_scope);
-        Scope* cur_scope = &(scopes.back());
-        for (auto t = ts.begin(); t != ts.end(); ) {
-            if (t->val=="namespace" &&
-                (t+1)!= ts.end() && (t+1)->type == CPP_NAME &&
-                (t+2)!= ts.end() && (t+2)->type == CPP_OPEN_BRACE) {
-                Scope sub;
-                sub.type = 0;
-                sub.name = (t+1)->val;
-                sub.sb.push(*(t+1));
-                sub.father = scopes;
-                for (auto itc = scopes.begin(); itc != scopes.end(); ++itc) {
-                    if (!itc->name.empty()) {
-                        sub.key += itc->name + "::"; 
-                    }
-                }
-                sub.key += sub.name;
-                
-                scopes.push_back(sub);
-                cur_scope = &scopes.back();
-                t+=3;
-                continue;
-            } else if (t->val=="namespace" && (t+1)->type == CPP_OPEN_BRACE) {
-                //不可以在匿名域中定义class
-                ++t;
-                jump_brace(t, ts);
-                ++t;
-                continue;
-            } else if (t->type == CPP_OPEN_BRACE) {
-                cur_scope->sb.push(*t);
-                ++t;
-                continue;
-            } else if (t->type == CPP_CLOSE_BRACE) {
-                cur_scope->sb.pop();
-                if (!cur_scope->name.empty() && cur_scope->sb.empty()) {
-                    //如果不是默认作用域 则跳出当前作用域
-                    scopes.pop_back();
-                    cur_scope = &scopes.back();
-                }
-                ++t;
+        TokenStream& ts = lex._ts;
+        ScopeID cur_scope = ROOT_SCOPE;
+        _scopes[ROOT_SCOPE].depth = 0;
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
+            if (update_scope(t, ts, cur_scope, false)) {
                 continue;
             }
 
@@ -2445,9 +2640,8 @@ void Obfuscator::extract_global_var_fn() {
             }
 
             //全局变量的提取
-            if (t->type == CPP_TYPE && t_n != ts.end() && t_nn != ts.end() &&
-                t_n->type == CPP_NAME && t_nn->type != CPP_SCOPE &&//排除函数定义, 也是类型+name
-                ((t) == ts.begin() ||
+            if (Pattern<Is<CPP_TYPE>, Is<CPP_NAME>, Not<CPP_SCOPE>>::match(t, ts) &&//排除函数定义, 也是类型+name
+                ((t-1)->type == CPP_EOF || //文件开头
                 (t-1)->type == CPP_OPEN_BRACE || //以 }结尾
                 (t-1)->type == CPP_COMMENT || //以注释结尾
                 (t-1)->type == CPP_MACRO || //以宏结尾
@@ -2466,8 +2660,8 @@ void Obfuscator::extract_global_var_fn() {
 
                     Function fn;
                     fn.name = t_n->val;
-                    fn.ret = *t;
-                    fn.scope = *cur_scope;
+                    fn.ret = _types.intern(*t);
+                    fn.scope = cur_scope;
                     _g_functions[fn.name] = fn;
 
                     t+=2;
@@ -2492,7 +2686,7 @@ void Obfuscator::extract_global_var_fn() {
                     //之前的都是全局变量, 
                     for (auto it_to_be_m=to_be_m.begin(); it_to_be_m!=to_be_m.end(); ++it_to_be_m) {
                         (*it_to_be_m)->type = CPP_GLOBAL_VARIABLE;
-                        _g_variable[(*it_to_be_m)->val] = {(*it_to_be_m)->val, t_type, *cur_scope};
+                        _g_variable[(*it_to_be_m)->val] = {(*it_to_be_m)->val, _types.intern(t_type), cur_scope};
                     }
                 } else {
                     if (t->type == CPP_OPEN_SQUARE) {
@@ -2528,7 +2722,7 @@ void Obfuscator::extract_global_var_fn() {
                 }
             } 
             //全局函数的提取, 寻找 fn(
-            else if (t->type == CPP_NAME && t_n != ts.end() && t_n->type == CPP_OPEN_PAREN) {
+            else if (t->type == CPP_NAME && t_n->type == CPP_OPEN_PAREN) {
                 //可能是函数
                 //找前一步type
                 auto t_p = t-1;
@@ -2550,8 +2744,8 @@ void Obfuscator::extract_global_var_fn() {
                     Function fn;
                     t->type = CPP_FUNCTION;
                     fn.name = t->val;
-                    fn.ret = *t_p;
-                    fn.scope = *cur_scope;
+                    fn.ret = _types.intern(*t_p);
+                    fn.scope = cur_scope;
                     _g_functions[fn.name] = fn;
                     ++t;
                     jump_paren(t,ts);
@@ -2578,68 +2772,17 @@ void Obfuscator::extract_local_var_fn() {
 
         std::cout << "extract local var fn: " << file_name << std::endl;
 
-        std::deque<Token>& ts = lex._ts;
-        std::deque<Scope> scopes;
-        Scope root_scope;
-        root_scope.type = 0;
-        scopes.push_back(root_scope);
-        Scope* cur_scope = &(scopes.back());
+        TokenStream& ts = lex._ts;
+        ScopeID cur_scope = ROOT_SCOPE;
+        _scopes[ROOT_SCOPE].depth = 0;
 
         _local_variable[file_name] = std::map<std::string, Variable>();
         std::map<std::string, Variable>& local_variable = _local_variable[file_name]; 
         _local_functions[file_name] = std::map<std::string, Function>();
         std::map<std::string, Function>& local_fn = _local_functions[file_name];
 
-        for (auto t = ts.begin(); t != ts.end(); ) {
-            if (t->val=="namespace" &&
-                (t+1)!= ts.end() && (t+1)->type == CPP_NAME &&
-                (t+2)!= ts.end() && (t+2)->type == CPP_OPEN_BRACE) {
-                Scope sub;
-                sub.type = 0;
-                sub.name = (t+1)->val;
-                sub.sb.push(*(t+1));
-                sub.father = scopes;
-                for (auto itc = scopes.begin(); itc != scopes.end(); ++itc) {
-                    if (!itc->name.empty()) {
-                        sub.key += itc->name + "::"; 
-                    }
-                }
-                sub.key += sub.name;
-                
-                scopes.push_back(sub);
-                cur_scope = &scopes.back();
-                t+=3;
-                continue;
-            } else if (t->val=="namespace" && (t+1)->type == CPP_OPEN_BRACE) {
-                //匿名区域
-                Scope sub;
-                sub.type = 0;
-                sub.name = ANONYMOUS_SCOPE;
-                sub.sb.push(*(t+1));
-                sub.father = scopes;
-                for (auto itc = scopes.begin(); itc != scopes.end(); ++itc) {
-                    if (!itc->name.empty()) {
-                        sub.key += itc->name + "::"; 
-                    }
-                }
-                sub.key += sub.name;
-                
-                scopes.push_back(sub);
-                cur_scope = &scopes.back();
-                t+=2;
-                continue;
-            } else if (t->type == CPP_OPEN_BRACE) {
-                cur_scope->sb.push(*t);
-                ++t;
-                continue;
-            } else if (t->type == CPP_CLOSE_BRACE) {
-                cur_scope->sb.pop();
-                if (!cur_scope->name.empty() && cur_scope->sb.empty()) {
-                    //如果不是默认作用域 则跳出当前作用域
-                    scopes.pop_back();
-                    cur_scope = &scopes.back();
-                }
-                ++t;
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
+            if (update_scope(t, ts, cur_scope, true)) {
                 continue;
             }
 
@@ -2709,9 +2852,8 @@ void Obfuscator::extract_local_var_fn() {
             auto t_n = t+1;
             auto t_nn = t+2;
 
-            if (t->type == CPP_TYPE && t_n != ts.end() && t_nn != ts.end() &&
-                t_n->type == CPP_NAME && t_nn->type != CPP_SCOPE &&//排除函数定义, 也是类型+name
-                ((t) == ts.begin() ||
+            if (Pattern<Is<CPP_TYPE>, Is<CPP_NAME>, Not<CPP_SCOPE>>::match(t, ts) &&//排除函数定义, 也是类型+name
+                ((t-1)->type == CPP_EOF || //文件开头
                 (t-1)->type == CPP_COMMENT || //以注释结尾
                 (t-1)->type == CPP_MACRO || //以宏结尾
                 (t-1)->type == CPP_PREPROCESSOR || //以预处理语句结尾
@@ -2735,8 +2877,8 @@ void Obfuscator::extract_local_var_fn() {
 
                     Function fn;
                     fn.name = t_n->val;
-                    fn.ret = *t;
-                    fn.scope = *cur_scope;
+                    fn.ret = _types.intern(*t);
+                    fn.scope = cur_scope;
 
                     if ((t-1)->val == "\"C\"" && (t-2)->val == "extern") {
                         //extern C 是导出的C风格的全局函数, 如果需要外面调用,则需要添加到ignore function中去
@@ -2776,7 +2918,7 @@ void Obfuscator::extract_local_var_fn() {
                     //之前的都是全局变量, 
                     for (auto it_to_be_m=to_be_m.begin(); it_to_be_m!=to_be_m.end(); ++it_to_be_m) {
                         (*it_to_be_m)->type = CPP_GLOBAL_VARIABLE;
-                        local_variable[(*it_to_be_m)->val] = {(*it_to_be_m)->val, t_type, *cur_scope};
+                        local_variable[(*it_to_be_m)->val] = {(*it_to_be_m)->val, _types.intern(t_type), cur_scope};
                     }
                 } else {
                     if (t->type == CPP_OPEN_SQUARE) {
@@ -2792,7 +2934,7 @@ void Obfuscator::extract_local_var_fn() {
                 }
             } 
             //全局函数的提取, 寻找 fn(
-            else if (t->type == CPP_NAME && t_n != ts.end() && t_n->type == CPP_OPEN_PAREN) {
+            else if (t->type == CPP_NAME && t_n->type == CPP_OPEN_PAREN) {
                 //可能是函数
                 //找前一步type
                 auto t_p = t-1;
@@ -2814,8 +2956,8 @@ void Obfuscator::extract_local_var_fn() {
                     Function fn;
                     t->type = CPP_FUNCTION;
                     fn.name = t->val;
-                    fn.ret = *t_p;
-                    fn.scope = *cur_scope;
+                    fn.ret = _types.intern(*t_p);
+                    fn.scope = cur_scope;
                     local_fn[fn.name] = fn;
                     ++t;
                     jump_paren(t,ts);
@@ -2833,13 +2975,23 @@ void Obfuscator::extract_local_var_fn() {
     }
 }
 
+TypeRef Obfuscator::recall_typedef_type(const std::string& name) {
+    //没有被识别成type的名称, 可能是typedef, 否则认为是三方类型
+    Token tt;
+    if (is_in_typedef(name, tt) && tt.type == CPP_TYPE) {
+        return _types.intern(tt);
+    }
+    std::cout << "LABEL: " << "may be is 3th type: " << name << std::endl;
+    return TYPE_OTHER;
+}
+
 //TODO LABEL 这里只能获取识别为type的参数
-std::map<std::string, Token> Obfuscator::label_skip_paren(std::deque<Token>::iterator& t, const std::deque<Token>& ts) {
+std::map<std::string, TypeRef> Obfuscator::label_skip_paren(std::deque<Token>::iterator& t, const TokenStream& ts) {
     std::stack<Token> sbrace;
     assert(t->type == CPP_OPEN_PAREN);
     sbrace.push(*t);
     ++t;
-    std::map<std::string, Token> paras;
+    std::map<std::string, TypeRef> paras;
     while(!sbrace.empty()) {
         if (t->type == CPP_CLOSE_PAREN) {
             assert(sbrace.top().type == CPP_OPEN_PAREN);
@@ -2848,19 +3000,13 @@ std::map<std::string, Token> Obfuscator::label_skip_paren(std::deque<Token>::ite
         } else if (t->type == CPP_OPEN_PAREN) {
             sbrace.push(*t);
             ++t;
-        } else if (t->type == CPP_TYPE &&
-                  (t+1) != ts.end() && (t+1)->type == CPP_OPEN_PAREN &&
-                  (t+2) != ts.end() && (t+2)->type == CPP_AND &&
-                  (t+3) != ts.end() && (t+3)->type == CPP_NAME &&
-                  (t+4) != ts.end() && (t+4)->type == CPP_CLOSE_PAREN &&
-                  (t+5) != ts.end() && (t+5)->type == CPP_OPEN_SQUARE) {
+        } else if (Pattern<Is<CPP_TYPE>, Is<CPP_OPEN_PAREN>, Is<CPP_AND>, Is<CPP_NAME>, Is<CPP_CLOSE_PAREN>, Is<CPP_OPEN_SQUARE>>::match(t, ts)) {
             //这种参数表 type(&name)[3]
-            paras[(t+3)->val] = *t;
+            paras[(t+3)->val] = _types.intern(*t);
             t += 6;
-        } else if (t->type == CPP_TYPE && 
-                  (t+1) != ts.end() && (t+1)->type == CPP_NAME) {
+        } else if (Pattern<Is<CPP_TYPE>, Is<CPP_NAME>>::match(t, ts)) {
             //经典的参数表 type name, type name, 
-            paras[(t+1)->val] = *t;
+            paras[(t+1)->val] = _types.intern(*t);
             t+=2;
         } else {
             ++t;
@@ -2869,20 +3015,19 @@ std::map<std::string, Token> Obfuscator::label_skip_paren(std::deque<Token>::ite
     if (t->val == "const") {
         ++t;
     }
-    if (t->val == "throw" && (t+1)!=ts.end() && (t+2)!=ts.end() &&
-       (t+1)->type == CPP_OPEN_PAREN && (t+2)->type == CPP_CLOSE_PAREN) {
+    if (Pattern<Kw<KwThrow>, Is<CPP_OPEN_PAREN>, Is<CPP_CLOSE_PAREN>>::match(t, ts)) {
         t+=3;
     }
 
     return paras;
 }
 
-Token Obfuscator::get_auto_type(
+TypeRef Obfuscator::get_auto_type(
     std::deque<Token>::iterator t, 
     const std::deque<Token>::iterator t_start, 
     const std::string& class_name, 
     const std::string& file_name, 
-    const std::map<std::string, Token>& paras,
+    const std::map<std::string, TypeRef>& paras,
     bool is_cpp) {
     assert(t->val == "auto");
 
@@ -2896,199 +3041,315 @@ Token Obfuscator::get_auto_type(
     return get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
 }
 
-Token Obfuscator::recall_subjust_type(
+//回溯局部变量时对位置t的判断, t处是v_name的声明则返回true
+bool Obfuscator::match_local_decl(
     std::deque<Token>::iterator t, 
     const std::deque<Token>::iterator t_start, 
+    const std::string& v_name,
     const std::string& class_name, 
     const std::string& file_name, 
-    const std::map<std::string, Token>& paras,
-    bool is_cpp) {
-
-    const std::string v_name = t->val;
+    const std::map<std::string, TypeRef>& paras,
+    bool is_cpp,
+    TypeRef& ret) {
+    auto t_p = t-1;
+    auto t_n = t+1;
+    if (t->val == v_name && t_n->type == CPP_EQ) {
+        //可能是复制构造 如 type a =
+        
+        //过滤掉 type[*&]
+        while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p>=t_start) {
+            --t_p;
+        }
 
-    //类成员变量
-    Token t_type;
-    if (is_member_variable(class_name, v_name, t_type)) {
-        return t_type;
-    }
-            
-    //参数表
-    auto it_p_v = paras.find(v_name);
-    if (it_p_v != paras.end()) {
-        return it_p_v->second;
-    }
-
-    //局部变量
-    while (t > t_start) {
-        auto t_p = t-1;
-        auto t_n = t+1;
-        if (t->val == v_name && t_n->type == CPP_EQ) {
-            //可能是复制构造 如 type a =
-            
-            //过滤掉 type[*&]
-            while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p>=t_start) {
-                --t_p;
-            }
+        if (t_p->val == "auto") {
+            //寻找赋值语句的右部
+            std::cout << "get type auto.\n";
+            ret = get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
+            return true;
+        } else if (t_p->type == CPP_TYPE) {
+            ret = _types.intern(*t_p);
+            return true;
+        } else if (t_p->type == CPP_NAME) {
+            ret = recall_typedef_type(t_p->val);
+            return true;
+        } else {
+            //do nothing
+        }
+    } else if (t->val == v_name && t_n->type == CPP_OPEN_SQUARE && 
+        (t_n+1)->type == CPP_CLOSE_SQUARE &&
+        (t_n+2)->type == CPP_EQ) {
+        //可能是数组复制构造 type a[] = 
+        //过滤掉 type[*&]
+        while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p<=t_start) {
+            --t_p;
+        }
 
-            if (t_p->val == "auto") {
-                //寻找赋值语句的右部
-                std::cout << "get type auto.\n";
-                return get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
-            } else if (t_p->type == CPP_TYPE) {
-                return *t_p;
-            } else if (t_p->type == CPP_NAME) {
-                std::cout << "LABEL: " << "may be is 3th type: " << t_p->val << std::endl;
-                Token tt;
-                tt.type = CPP_OTHER;
-                return tt;
-            } else {
-                //do nothing
-            }
-        } else if (t->val == v_name && t_n->type == CPP_OPEN_SQUARE && 
-            (t_n+1)->type == CPP_CLOSE_SQUARE &&
-            (t_n+2)->type == CPP_EQ) {
-            //可能是数组复制构造 type a[] = 
-            //过滤掉 type[*&]
-            while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p<=t_start) {
-                --t_p;
-            }
+        if (t_p->val == "auto") {
+            //寻找赋值语句的右部
+            std::cout << "get type auto.\n";
+            ret = get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
+            return true;
+        } else if (t_p->type == CPP_TYPE) {
+            ret = _types.intern(*t_p);
+            return true;
+        } else if (t_p->type == CPP_NAME) {
+            ret = recall_typedef_type(t_p->val);
+            return true;
+        } else {
+            //do nothing
+        }
+    } else if (t->val == v_name && t_n->type == CPP_OPEN_PAREN) {
+        //可能是拷贝构造 如 type a(...)
+        //过滤掉 type[*&]
+        while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p<=t_start) {
+            --t_p;
+        }
 
-            if (t_p->val == "auto") {
-                //寻找赋值语句的右部
-                std::cout << "get type auto.\n";
-                return get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
-            } else if (t_p->type == CPP_TYPE) {
-                return *t_p;
-            } else if (t_p->type == CPP_NAME) {
-                std::cout << "LABEL: " << "may be is 3th type: " << t_p->val << std::endl;
-                Token tt;
-                tt.type = CPP_OTHER;
-                return tt;
-            } else {
-                //do nothing
-            }
-        } else if (t->val == v_name && t_n->type == CPP_OPEN_PAREN) {
-            //可能是拷贝构造 如 type a(...)
-            //过滤掉 type[*&]
-            while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p<=t_start) {
-                --t_p;
-            }
+        if (t_p->val == "auto") {
+            //寻找赋值语句的右部
+            std::cout << "get type auto.\n";
+            ret = get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
+            return true;
+        } else if (t_p->type == CPP_TYPE) {
+            ret = _types.intern(*t_p);
+            return true;
+        } else if (t_p->type == CPP_NAME) {
+            ret = recall_typedef_type(t_p->val);
+            return true;
+        } else {
+            //do nothing
+        }
+    } else if (t->val == v_name && t_n->type == CPP_SEMICOLON) {
+        //没有默认参数的构造（warning） 如 type a;
+        while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p<=t_start) {
+            --t_p;
+        }
 
-            if (t_p->val == "auto") {
-                //寻找赋值语句的右部
-                std::cout << "get type auto.\n";
-                return get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
-            } else if (t_p->type == CPP_TYPE) {
-                return *t_p;
-            } else if (t_p->type == CPP_NAME) {
-                std::cout << "LABEL: " << "may be is 3th type: " << t_p->val << std::endl;
-                Token tt;
-                tt.type = CPP_OTHER;
-                return tt;
-            } else {
-                //do nothing
-            }
-        } else if (t->val == v_name && t_n->type == CPP_SEMICOLON) {
-            //没有默认参数的构造（warning） 如 type a;
-            while((t_p->type == CPP_MULT || t_p->type == CPP_AND) && t_p<=t_start) {
+        if (t_p->val == "auto") {
+            //寻找赋值语句的右部
+            std::cerr << "dont support auto it;\n";
+            ret = TYPE_OTHER;
+            return true;
+        } else if (t_p->type == CPP_TYPE) {
+            ret = _types.intern(*t_p);
+            return true;
+        } else if (t_p->type == CPP_NAME) {
+            ret = recall_typedef_type(t_p->val);
+            return true;
+        } else if (t_p->type == CPP_COMMA) {
+            //可能遇到 type a,b,target;这种情况
+        MULTI_VARIABLE:
+            //往前找type
+            --t_p;
+            while((t_p->type == CPP_MULT || t_p->type == CPP_AND || t_p->type == CPP_NAME) && t_p<=t_start) {
                 --t_p;
             }
 
-            if (t_p->val == "auto") {
-                //寻找赋值语句的右部
-                std::cerr << "dont support auto it;\n";
-                Token tt;
-                tt.type = CPP_OTHER;
-                return tt;
-            } else if (t_p->type == CPP_TYPE) {
-                return *t_p;
-            } else if (t_p->type == CPP_NAME) {
-                std::cout << "LABEL: " << "may be is 3th type: " << t_p->val << std::endl;
-                Token tt;
-                tt.type = CPP_OTHER;
-                return tt;
-            } else if (t_p->type == CPP_COMMA) {
-                //可能遇到 type a,b,target;这种情况
-            MULTI_VARIABLE:
-                //往前找type
-                --t_p;
-                while((t_p->type == CPP_MULT || t_p->type == CPP_AND || t_p->type == CPP_NAME) && t_p<=t_start) {
-                    --t_p;
-                }
-
-                if (t_p->type == CPP_TYPE) {
-                    return *t_p;
-                } else if (t_p->type == CPP_COMMA) {
-                    goto MULTI_VARIABLE;
-                } else if (t_p->type == CPP_NAME && (t_p-1)->type == CPP_COMMA) {
-                    //type a,b,c;
-                    goto MULTI_VARIABLE;
-                } else if (t_p->type == CPP_NAME && (t_p-1)->type == CPP_TYPE) {
-                    return *(t_p-1);
-                } else {
-                    //do nothing, try other case
-                }
-            }
-        } else if (t->val == v_name && t_n->type == CPP_COMMA && ((t-1)->type == CPP_TYPE || (t-1)->type == CPP_COMMA)) {
-            //type a,b,c;
             if (t_p->type == CPP_TYPE) {
-                return *t_p;
+                ret = _types.intern(*t_p);
+                return true;
             } else if (t_p->type == CPP_COMMA) {
                 goto MULTI_VARIABLE;
+            } else if (t_p->type == CPP_NAME && (t_p-1)->type == CPP_COMMA) {
+                //type a,b,c;
+                goto MULTI_VARIABLE;
+            } else if (t_p->type == CPP_NAME && (t_p-1)->type == CPP_TYPE) {
+                ret = _types.intern(*(t_p-1));
+                return true;
             } else {
                 //do nothing, try other case
             }
-
-        } else if (t->val == v_name && t_n->type == CPP_OPEN_SQUARE && 
-            (t_n+2)->type == CPP_CLOSE_SQUARE && 
-            ((t_n+3)->type == CPP_SEMICOLON || (t_n+3)->type == CPP_EQ)) {
-            //type a[num];
-            //type a[num] = ;
-            if (t_p->val == "auto") {
-                //寻找赋值语句的右部
-                std::cout << "get type auto.\n";
-                return get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
-            } else if (t_p->type == CPP_TYPE) {
-                return *t_p;
-            } else if (t_p->type == CPP_NAME) {
-                std::cout << "LABEL: " << "may be is 3th type: " << t_p->val << std::endl;
-                Token tt;
-                tt.type = CPP_OTHER;
-                return tt;
-            } else {
-                //do nothing
+        }
+    } else if (t->val == v_name && t_n->type == CPP_COMMA && ((t-1)->type == CPP_TYPE || (t-1)->type == CPP_COMMA)) {
+        //type a,b,c;
+        if (t_p->type == CPP_TYPE) {
+            ret = _types.intern(*t_p);
+            return true;
+        } else if (t_p->type == CPP_COMMA) {
+            goto MULTI_VARIABLE;
+        } else {
+            //do nothing, try other case
+        }
+
+    } else if (t->val == v_name && t_n->type == CPP_OPEN_SQUARE && 
+        (t_n+2)->type == CPP_CLOSE_SQUARE && 
+        ((t_n+3)->type == CPP_SEMICOLON || (t_n+3)->type == CPP_EQ)) {
+        //type a[num];
+        //type a[num] = ;
+        if (t_p->val == "auto") {
+            //寻找赋值语句的右部
+            std::cout << "get type auto.\n";
+            ret = get_auto_type(t_p, t_start, class_name, file_name, paras, is_cpp);
+            return true;
+        } else if (t_p->type == CPP_TYPE) {
+            ret = _types.intern(*t_p);
+            return true;
+        } else if (t_p->type == CPP_NAME) {
+            ret = recall_typedef_type(t_p->val);
+            return true;
+        } else {
+            //do nothing
+        }
+
+
+    } else if (t->val == "catch" && (t+1)->type == CPP_OPEN_PAREN) {
+        //catch语句的特殊处理, 在catch的括号内部寻找可能的赋值语句
+        std::stack<Token> t_c_p;
+        t_c_p.push(*(t+1));
+        auto t0 = t+2;
+        while(!t_c_p.empty()) {
+            if (t0->type == CPP_OPEN_PAREN) {
+                t_c_p.push(*t0);
+            } else if (t0->type == CPP_CLOSE_PAREN) {
+                t_c_p.pop();
+            } else if (t0->type == CPP_TYPE && (t0+1)->val == v_name) {
+                //变量是catch中的参数
+                ret = _types.intern(*t0);
+                return true;
             }
+            ++t0;
+        }
+    } else if (t->val == v_name && (t+1)->type == CPP_OPEN_SQUARE && (t-1)->type == CPP_TYPE) {
+        //可能是 a[] = 
+        //跳过数组找等号
+        auto t_n = t+1;
+        jump_square(t_n, *_label_ts);
+        ++t_n;
+        if(t_n->type == CPP_EQ) {
+            //找到赋值语句
+            ret = _types.intern(*(t-1));
+            return true;
+        }
+        
+    }
+    return false;
+}
 
+const LocalDeclIndex& Obfuscator::get_local_decls(std::deque<Token>::iterator t_start) {
+    auto it_idx = _local_decls.find(&(*t_start));
+    if (it_idx != _local_decls.end()) {
+        return it_idx->second;
+    }
 
-        } else if (t->val == "catch" && (t+1)->type == CPP_OPEN_PAREN) {
-            //catch语句的特殊处理, 在catch的括号内部寻找可能的赋值语句
-            std::stack<Token> t_c_p;
-            t_c_p.push(*(t+1));
+    LocalDeclIndex& index = _local_decls[&(*t_start)];
+    //每个块中的声明在块结束时确定可见范围
+    typedef std::vector<std::pair<std::vector<LocalDecl>*, size_t>> BlockDecls;
+    std::vector<BlockDecls> blocks(1);
+    BlockDecls catch_decls;//catch的参数在后面的块中可见
+    auto t = t_start+1;
+    while (!blocks.empty()) {
+        const int pos = t - t_start;
+        auto t_n = t+1;
+        if (t->type == CPP_OPEN_BRACE || t->type == CPP_CLASS_BEGIN) {
+            blocks.push_back(BlockDecls());
+            blocks.back().swap(catch_decls);
+        } else if (t->type == CPP_CLOSE_BRACE || t->type == CPP_CLASS_END) {
+            BlockDecls& bd = blocks.back();
+            for (auto it = bd.begin(); it != bd.end(); ++it) {
+                (*(it->first))[it->second].end = pos;
+            }
+            blocks.pop_back();
+        } else if (t->val == "catch" && t_n->type == CPP_OPEN_PAREN) {
+            int paren = 1;
             auto t0 = t+2;
-            while(!t_c_p.empty()) {
+            while (paren > 0) {
                 if (t0->type == CPP_OPEN_PAREN) {
-                    t_c_p.push(*t0);
+                    ++paren;
                 } else if (t0->type == CPP_CLOSE_PAREN) {
-                    t_c_p.pop();
-                } else if (t0->type == CPP_TYPE && (t0+1)->val == v_name) {
-                    //变量是catch中的参数
-                    return *t0;
+                    --paren;
+                } else if (t0->type == CPP_TYPE) {
+                    std::vector<LocalDecl>& ds = index.decls[(t0+1)->val];
+                    ds.push_back({pos, -1});
+                    catch_decls.push_back(std::make_pair(&ds, ds.size()-1));
                 }
                 ++t0;
             }
-        } else if (t->val == v_name && (t+1)->type == CPP_OPEN_SQUARE && (t-1)->type == CPP_TYPE) {
-            //可能是 a[] = 
-            //跳过数组找等号
-            auto t_n = t+1;
-            jump_square(t_n);
-            ++t_n;
-            if(t_n->type == CPP_EQ) {
-                //找到赋值语句
-                return *(t-1);
+        } else if (!t->val.empty() && 
+            (t_n->type == CPP_EQ || 
+             t_n->type == CPP_OPEN_SQUARE || 
+             t_n->type == CPP_OPEN_PAREN || 
+             t_n->type == CPP_SEMICOLON || 
+             t_n->type == CPP_COMMA)) {
+            std::vector<LocalDecl>& ds = index.decls[t->val];
+            ds.push_back({pos, -1});
+            blocks.back().push_back(std::make_pair(&ds, ds.size()-1));
+        }
+        ++t;
+    }
+
+    return index;
+}
+
+bool Obfuscator::find_local_variable(
+    std::deque<Token>::iterator t, 
+    const std::deque<Token>::iterator t_start, 
+    const std::string& class_name, 
+    const std::string& file_name, 
+    const std::map<std::string, TypeRef>& paras,
+    bool is_cpp,
+    TypeRef& ret) {
+
+    const std::string& v_name = t->val;
+    if (t_start->type != CPP_OPEN_BRACE) {
+        //不是函数体, 逐个回溯
+        for (auto t_r = t; t_r > t_start; --t_r) {
+            if (match_local_decl(t_r, t_start, v_name, class_name, file_name, paras, is_cpp, ret)) {
+                return true;
             }
-            
         }
-        --t;
+        return false;
+    }
+
+    const LocalDeclIndex& index = get_local_decls(t_start);
+    auto it_ds = index.decls.find(v_name);
+    if (it_ds == index.decls.end()) {
+        return false;
+    }
+
+    //从最近的声明往前找, 跳过已经结束的块中的声明
+    const int pos = t - t_start;
+    const std::vector<LocalDecl>& ds = it_ds->second;
+    auto it_d = std::upper_bound(ds.begin(), ds.end(), pos, [](int pos, const LocalDecl& d) {
+        return pos < d.pos;
+    });
+    while (it_d != ds.begin()) {
+        --it_d;
+        if (pos > it_d->end) {
+            continue;
+        }
+        if (match_local_decl(t_start + it_d->pos, t_start, v_name, class_name, file_name, paras, is_cpp, ret)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TypeRef Obfuscator::recall_subjust_type(
+    std::deque<Token>::iterator t, 
+    const std::deque<Token>::iterator t_start, 
+    const std::string& class_name, 
+    const std::string& file_name, 
+    const std::map<std::string, TypeRef>& paras,
+    bool is_cpp) {
+
+    const std::string v_name = t->val;
+
+    //类成员变量
+    TypeRef t_type;
+    if (is_member_variable(class_name, v_name, t_type)) {
+        return t_type;
+    }
+            
+    //参数表
+    auto it_p_v = paras.find(v_name);
+    if (it_p_v != paras.end()) {
+        return it_p_v->second;
+    }
+
+    //局部变量
+    TypeRef t_local;
+    if (find_local_variable(t, t_start, class_name, file_name, paras, is_cpp, t_local)) {
+        return t_local;
     }
 
     //全局变量
@@ -3102,17 +3363,15 @@ Token Obfuscator::recall_subjust_type(
             
     std::cerr << "reback to get type of: " << v_name << " failed.";
     //assert(false);
-    Token tt;
-    tt.type = CPP_OTHER;
-    return tt;
+    return TYPE_OTHER;
 }
 
-Token Obfuscator::get_fn_ret_type(
+TypeRef Obfuscator::get_fn_ret_type(
     std::deque<Token>::iterator& t, 
     const std::deque<Token>::iterator t_start, 
     const std::string& class_name, 
     const std::string& file_name, 
-    const std::map<std::string, Token>& paras, bool is_cpp) {
+    const std::map<std::string, TypeRef>& paras, bool is_cpp) {
     
     const std::string fn_name = t->val;
     const bool deref = check_deref(t, true);
@@ -3120,15 +3379,12 @@ Token Obfuscator::get_fn_ret_type(
     if((t-1)->type == CPP_SCOPE) {
         std::cout << "static call with class: " << (t-2)->val << "\n";
         const std::string sc_name = (t-2)->val;
-        Token ret;
+        TypeRef ret;
         if (is_member_function(sc_name, fn_name, ret)) {
-            ret.deref = deref;
-            return ret;
+            return _types.set_deref(ret, deref);
         } else {
             //3th 模块的静态调用
-            Token t_o;
-            t_o.type = CPP_OTHER;
-            return t_o;
+            return TYPE_OTHER;
         }
     }
 
@@ -3137,118 +3393,98 @@ Token Obfuscator::get_fn_ret_type(
         ///\3 没有主语则匹配 全局函数 / 函数成员函数 / 或者局部函数(需要是cpp文件)
 
         //1.1 匹配成员函数
-        Token ret;
+        TypeRef ret;
         //把该类以及基类的方法拿出来查看
         if (!class_name.empty() && is_member_function(class_name, fn_name, ret)) {
-            ret.deref = deref;
-            return ret;
+            return _types.set_deref(ret, deref);
         }
         
         if (is_ignore_function(fn_name)) {
-            ret.type = CPP_OTHER;
-            return ret;
+            return TYPE_OTHER;
         }
 
         //1.2 匹配全局函数
         if (is_global_function(fn_name, ret)) {
             std::cout << "is global fn\n";
-            ret.deref = deref;
-            return ret;
+            return _types.set_deref(ret, deref);
         }
 
         //1.3 如果是cpp则匹配局部函数
         if (is_cpp && is_local_function(file_name, fn_name, ret)) {
-            ret.deref = deref;
-            return ret;
+            return _types.set_deref(ret, deref);
         }
 
-        ret.type = CPP_OTHER;
-        return ret;
+        return TYPE_OTHER;
 
     } else {
         --t;
         --t;
         //继续寻找主语类型
 
-        Token tt = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
-        if (tt.type == CPP_OTHER) {
+        const TypeRef tt = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
+        if (tt == TYPE_OTHER) {
             return tt;
         }
+        const std::string& tt_val = _types.val(tt);
 
-        if (tt.val == "weak_ptr" && fn_name == "lock") {
+        if (tt_val == "weak_ptr" && fn_name == "lock") {
             // weak_ptr.lock()
-            return tt.ts[0];
+            return _types.child(tt, 0);
         }
 
-        Token ret;
-        if (is_member_function(tt.val, fn_name, ret)) {
+        TypeRef ret;
+        if (is_member_function(tt_val, fn_name, ret)) {
             return ret;
         }
 
         //看是否是迭代器或者容器
-        if (tt.val == "iterator" || tt.val == "const_iterator") {
+        if (tt_val == "iterator" || tt_val == "const_iterator") {
             //可能不会是键值对类型
-            assert(!tt.ts.empty());
-            assert(!tt.ts[0].ts.empty());
-            if (is_member_function(tt.ts[0].ts[0].val, fn_name, ret)) {
+            assert(!_types.get(tt).ts.empty());
+            assert(!_types.get(_types.child(tt, 0)).ts.empty());
+            if (is_member_function(_types.val(_types.child(_types.child(tt, 0), 0)), fn_name, ret)) {
                 return ret;
             } else {
-                Token t_o;
-                t_o.type = CPP_OTHER;
-                return t_o;
+                return TYPE_OTHER;
             }
-        } else if (is_stl_container(tt.val)) {
+        } else if (is_stl_container(tt_val)) {
             //是容器
-            std::cout << "contaier " << tt.val << " 's function: " << fn_name << " called \n";
+            std::cout << "contaier " << tt_val << " 's function: " << fn_name << " called \n";
             if (is_stl_container_ret_iterator(fn_name)) {
-                if (tt.val == "shared_ptr" || tt.val == "auto_ptr" || tt.val == "unique_ptr") {
+                if (tt_val == "shared_ptr" || tt_val == "auto_ptr" || tt_val == "unique_ptr") {
                     //LABEL 智能指针包含容器
-                    Token ret0;
-                    ret0.type = CPP_TYPE;
-                    ret0.val = "iterator";
-                    ret0.ts.push_back(tt.ts[0]);
-                    return ret0;
+                    return _types.make("iterator", std::vector<TypeRef>(1, _types.child(tt, 0)));
                 } else {
-                    Token ret0;
-                    ret0.type = CPP_TYPE;
-                    ret0.val = "iterator";
-                    ret0.ts.push_back(tt);
-                    return ret0;
+                    return _types.make("iterator", std::vector<TypeRef>(1, tt));
                 }
             } else if (is_stl_container_ret_val(fn_name)) {
-                assert(!tt.ts.empty());
-                return tt.ts[0];
-            } else if (tt.val == "shared_ptr" || tt.val == "auto_ptr" || tt.val == "unique_ptr") {
-                if (is_member_function(tt.ts[0].val, fn_name, ret)) {
+                assert(!_types.get(tt).ts.empty());
+                return _types.child(tt, 0);
+            } else if (tt_val == "shared_ptr" || tt_val == "auto_ptr" || tt_val == "unique_ptr") {
+                if (is_member_function(_types.val(_types.child(tt, 0)), fn_name, ret)) {
                     return ret;
                 } else {
-                    Token t_o;
-                    t_o.type = CPP_OTHER;
-                    return t_o;
+                    return TYPE_OTHER;
                 }
             } else {
-                Token t_o;
-                t_o.type = CPP_OTHER;
-                return t_o;
+                return TYPE_OTHER;
             }
         } else {
             //TODO 无法分析
-            Token t_o;
-            t_o.type = CPP_OTHER;
-            return t_o;
+            return TYPE_OTHER;
         }
     }
 }
 
-Token Obfuscator::get_close_subject_type(
+TypeRef Obfuscator::get_close_subject_type(
         std::deque<Token>::iterator& t, 
         const std::deque<Token>::iterator t_start, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp) {
     assert(t->type == CPP_OPEN_PAREN);
-    jump_paren(t);
+    jump_paren(t, *_label_ts);
     assert(t->type == CPP_CLOSE_PAREN);
     --t;
     //封闭式的类型分析, 从尾到头分析(主要分析最后一个元素)
@@ -3265,7 +3501,7 @@ bool Obfuscator::check_deref(std::deque<Token>::iterator t, bool is_fn) {
         //跳过函数调用看有没有括号
         ++t;
         assert(t->type == CPP_OPEN_PAREN);
-        jump_paren(t);
+        jump_paren(t, *_label_ts);
         ++t;
 
         if (t->type == CPP_PLUS_PLUS || t->type == CPP_AND_AND) {
@@ -3274,7 +3510,7 @@ bool Obfuscator::check_deref(std::deque<Token>::iterator t, bool is_fn) {
         }
 
         if (t->type == CPP_CLOSE_PAREN) {
-            jump_before_praen(t);         
+            jump_before_praen(t, _label_ts->begin(), *_label_ts);
         } else {
             return deref;
         }
@@ -3285,141 +3521,190 @@ bool Obfuscator::check_deref(std::deque<Token>::iterator t, bool is_fn) {
     }
 }
 
-Token Obfuscator::get_subject_type(
+TypeRef Obfuscator::get_subject_type(
+    std::deque<Token>::iterator& t, 
+    const std::deque<Token>::iterator t_start, 
+    const std::string& class_name, 
+    const std::string& file_name, 
+    const std::map<std::string, TypeRef>& paras,
+    bool is_cpp) {
+    //同一个函数体内(class/参数表不变)相同位置的主语类型只推导一次, 失败(TYPE_OTHER)也记录
+    std::unordered_map<int, TypeRef>& memo = _subject_types[&(*t_start)];
+    const int pos = t - t_start;
+    auto it_m = memo.find(pos);
+    if (it_m != memo.end()) {
+        return it_m->second;
+    }
+
+    //显式栈: 沿调用链向左把还没推导的主语压栈, 再从最里面的主语开始推导,
+    //这样每一层resolve_subject_type取前缀类型时都命中memo, 链式调用不会递归加深
+    std::vector<std::deque<Token>::iterator> st;
+    st.push_back(t);
+    std::deque<Token>::iterator t_r;
+    while (subject_receiver(st.back(), t_start, *_label_ts, t_r) && t_r > t_start && memo.find(t_r - t_start) == memo.end()) {
+        st.push_back(t_r);
+    }
+
+    int& steps = _infer_steps[&(*t_start)];
+    //括号/数组/auto的主语在resolve_subject_type中还会调用get_subject_type, 不能用栈展开,
+    //嵌套太深时这个主语认为是未知类型, 并用完整个函数体的预算
+    if (_infer_depth >= MAX_INFER_DEPTH) {
+        if (steps <= _infer_budget) {
+            std::cerr << "type inference too deep in " << file_name << " function at loc " 
+            << t_start->loc << ", remain subjects are unknown.\n";
+            steps = _infer_budget+1;
+        }
+        return TYPE_OTHER;
+    }
+    while (!st.empty()) {
+        auto t_c = st.back();
+        st.pop_back();
+        const int pos_c = t_c - t_start;
+        if (memo.find(pos_c) != memo.end()) {
+            continue;
+        }
+        //先记录为失败, auto相互引用(auto a = a->next)时不会无限递归
+        memo[pos_c] = TYPE_OTHER;
+        if (++steps > _infer_budget) {
+            if (steps == _infer_budget+1) {
+                std::cerr << "type inference budget exceeded in " << file_name << " function at loc " 
+                << t_start->loc << ", remain subjects are unknown.\n";
+            }
+            continue;
+        }
+        ++_infer_depth;
+        memo[pos_c] = resolve_subject_type(t_c, t_start, class_name, file_name, paras, is_cpp);
+        --_infer_depth;
+    }
+    return memo[pos];
+}
+
+TypeRef Obfuscator::resolve_subject_type(
     std::deque<Token>::iterator& t, 
     const std::deque<Token>::iterator t_start, 
     const std::string& class_name, 
     const std::string& file_name, 
-    const std::map<std::string, Token>& paras,
+    const std::map<std::string, TypeRef>& paras,
     bool is_cpp) {
     
     //主语类型 函数 或者 变量
     auto t_p = t-1;
     if (t->val == "this") {
         std::cout << "subject is this, return type of class: " << class_name << std::endl;
-        Token tt;
-        tt.type = CPP_TYPE;
-        tt.val = class_name;
-        return tt;
+        return _types.make(class_name, std::vector<TypeRef>());
     } else if ((t->val == "first" || t->val == "second" || t->type == CPP_NAME) &&
                (t_p->type == CPP_DOT || t_p->type == CPP_POINTER)) {
         auto t_r = t-2;
-        Token tt = get_subject_type(t_r, t_start, class_name, file_name, paras, is_cpp);
-        if (tt.type == CPP_OTHER) {
+        TypeRef tt = get_subject_type(t_r, t_start, class_name, file_name, paras, is_cpp);
+        if (tt == TYPE_OTHER) {
             return tt;
         }
 
-        CHECK_CLASS_MEMBER:
-
-        if ((tt.val == "pair" || tt.val == "map") && (t->val == "first" || t->val == "second")) {
-            //键值对容器
-            assert(tt.ts.size() ==2);
-            if (t->val == "first") {
-                return tt.ts[0];
-            } else {
-                return tt.ts[1];
-            }
-        } else if (tt.val == "iterator" || tt.val == "const_iterator") {
-            //迭代器
-            assert(!tt.ts.empty());
-            if ((tt.deref && tt.ts[0].val == "vector") || (t_p->type == CPP_POINTER && tt.ts[0].val == "vector")) {
-                //对vector的特殊处理, 解引用和迭代器的-> 都是返回元素的成员
-                Token tmp = tt.ts[0].ts[0];
-                tt = tmp;
-                goto CHECK_CLASS_MEMBER;
-            } else {
-                if (t->val == "second") {
-                    assert(tt.ts[0].ts.size() >= 2);
-                    return tt.ts[0].ts[1];
-                } else {//有可能是first 或者 其他的容器
-                    assert(!tt.ts[0].ts.empty());
-                    return tt.ts[0].ts[0];
+        //vector的迭代器解引用后换成元素类型, 重新判断成员
+        while (true) {
+            if ((_types.val(tt) == "pair" || _types.val(tt) == "map") && (t->val == "first" || t->val == "second")) {
+                //键值对容器
+                assert(_types.get(tt).ts.size() ==2);
+                if (t->val == "first") {
+                    return _types.child(tt, 0);
+                } else {
+                    return _types.child(tt, 1);
                 }
-            }
-        } else {
-            //t->val 是 tt的成员
-            //判断是否是智能指针
-        //CHECK_CLASS_MEMBER:
-            if ((tt.val == "shared_ptr" || tt.val == "auto_ptr" || tt.val == "unique_ptr") && t_p->type == CPP_POINTER) {
-                Token ttt = tt.ts[0];
-                tt = ttt;
-            }
-            
-            bool tm=false;
-            if (is_in_class_struct(tt.val, tm)) {
-                //找class tt的成员变量
-                Token t_m;
-                if (is_member_variable(tt.val, t->val, t_m)) {
-                    std::cout << "find class member: " << t->val << " in class: " << tt.val << std::endl;
-                    return t_m;
+            } else if (_types.val(tt) == "iterator" || _types.val(tt) == "const_iterator") {
+                //迭代器
+                assert(!_types.get(tt).ts.empty());
+                const TypeRef tt0 = _types.child(tt, 0);
+                if ((_types.get(tt).deref && _types.val(tt0) == "vector") || (t_p->type == CPP_POINTER && _types.val(tt0) == "vector")) {
+                    //对vector的特殊处理, 解引用和迭代器的-> 都是返回元素的成员
+                    tt = _types.child(tt0, 0);
+                    continue;
                 } else {
-                    std::cout << "can't find class member: " << t->val << " in class: " << tt.val << std::endl;
-                    Token t_o;
-                    t_o.type = CPP_OTHER;
-                    return t_o;
+                    if (t->val == "second") {
+                        assert(_types.get(tt0).ts.size() >= 2);
+                        return _types.child(tt0, 1);
+                    } else {//有可能是first 或者 其他的容器
+                        assert(!_types.get(tt0).ts.empty());
+                        return _types.child(tt0, 0);
+                    }
                 }
             } else {
-                Token t_o;
-                t_o.type = CPP_OTHER;
-                return t_o;
-            }            
+                //t->val 是 tt的成员
+                //判断是否是智能指针
+                if ((_types.val(tt) == "shared_ptr" || _types.val(tt) == "auto_ptr" || _types.val(tt) == "unique_ptr") && t_p->type == CPP_POINTER) {
+                    tt = _types.child(tt, 0);
+                }
+            
+                bool tm=false;
+                const std::string& c_name = _types.val(tt);
+                if (is_in_class_struct(c_name, tm)) {
+                    //找class tt的成员变量
+                    TypeRef t_m;
+                    if (is_member_variable(c_name, t->val, t_m)) {
+                        std::cout << "find class member: " << t->val << " in class: " << c_name << std::endl;
+                        return t_m;
+                    } else {
+                        std::cout << "can't find class member: " << t->val << " in class: " << c_name << std::endl;
+                        return TYPE_OTHER;
+                    }
+                } else {
+                    return TYPE_OTHER;
+                }            
+            }
         }
     } else if (t->type == CPP_CLOSE_SQUARE) {
         //数组
         //跳过找到CPP_OPEN_SQUARE
         auto t_r = t;
-        jump_before_square(t_r, t_start);
-        Token tt = get_subject_type(t_r, t_start, class_name, file_name, paras, is_cpp);
-        if (tt.type == CPP_OTHER) {
+        jump_before_square(t_r, t_start, *_label_ts);
+        const TypeRef tt = get_subject_type(t_r, t_start, class_name, file_name, paras, is_cpp);
+        if (tt == TYPE_OTHER) {
             return tt;
         }
 
-        if (tt.val == "vector") {
+        if (_types.val(tt) == "vector") {
             //重载[]的容器
-            return tt.ts[0];
-        } else if (tt.val == "map") {
+            return _types.child(tt, 0);
+        } else if (_types.val(tt) == "map") {
             //重载[]的容器
-            return tt.ts[1];
-        } else if (tt.val == "unique_ptr") {
-            return tt.ts[0];
-        } else if (tt.type == CPP_TYPE) {
+            return _types.child(tt, 1);
+        } else if (_types.val(tt) == "unique_ptr") {
+            return _types.child(tt, 0);
+        } else if (_types.get(tt).type == CPP_TYPE) {
             //数组
             return tt;
         } else {
             assert(false);
-            //return tt;
+            return TYPE_OTHER;
         }
 
     } else if (t->type == CPP_CLOSE_PAREN) {
         //可能用括号隔离了一个类型 或者 是另一个函数调用
         auto t_r = t;
-        jump_before_praen(t_r, t_start);
+        jump_before_praen(t_r, t_start, *_label_ts);
         //assert(t_r->type == CPP_OPEN_PAREN);
         if (t_r->type == CPP_MEMBER_FUNCTION) {
             assert((t_r-1)->type == CPP_SCOPE);
             std::string call_c_name = (t_r-2)->val;
-            Token tt;
+            TypeRef tt;
             if (is_member_function(call_c_name, t_r->val,tt)) {
                 return tt;
             } else {
                 assert(false);
+                return TYPE_OTHER;
             }
         } else if (t_r->type == CPP_TYPE) {
             //直接构造函数返回如 A().a_fn();
-            return *t_r;
+            return _types.intern(*t_r);
         } else if (t_r->type == CPP_NAME || t_r->type == CPP_CALL) {
             //函数调用
-            Token tt = get_fn_ret_type(t_r, t_start, class_name, file_name, paras, is_cpp);
-            return tt;
+            return get_fn_ret_type(t_r, t_start, class_name, file_name, paras, is_cpp);
         } else if (t_r->val == "typeid") {
             //typeid的返回不重要
-            Token tt;
-            tt.type = CPP_OTHER;
-            return tt;
+            return TYPE_OTHER;
         } else if (t_r->type == CPP_GREATER) {
             //可能是模板函数, 获取<>中的内容以及模板函数的方法
-            Token t_paras = *(t_r-1);
-            jump_before_angle_brace(t_r, t_start);
+            const Token& t_paras = *(t_r-1);
+            jump_before_angle_brace(t_r, t_start, *_label_ts);
             if (t_r->type == CPP_NAME) {
                 //是模板函数
                 if ((t_r->val == "static_cast" ||
@@ -3427,48 +3712,43 @@ Token Obfuscator::get_subject_type(
                     t_r->val == "const_cast" ||
                     t_r->val == "dynamic_pointer_cast" || 
                     t_r->val == "make_shared") && t_paras.type == CPP_TYPE) {
-                    return t_paras;
+                    return _types.intern(t_paras);
                 } else {
                     std::cout << "cant handle template fn call: " << t_r->val << std::endl;
-                    Token tt;
-                    tt.type = CPP_OTHER;
-                    return tt;
+                    return TYPE_OTHER;
                 }
             } else {
                 std::cout << "unknow syntax: " << t_r->val << std::endl;
-                Token tt;
-                tt.type = CPP_OTHER;
-                return tt;
+                return TYPE_OTHER;
             }
         }
         //else if (t_p->type == CPP_MULT){}//TODO 解引用要分析吗?
         else {
             //存萃的类型，则分析括号内部的内容
             ++t_r;//(
-            Token tt = get_close_subject_type(t_r, t_start, class_name, file_name, paras, is_cpp);
-            return tt;
+            return get_close_subject_type(t_r, t_start, class_name, file_name, paras, is_cpp);
         }
     } else if (t->type == CPP_NAME) {
         //递归的终点
         bool deref = check_deref(t,false);
-        Token tt = recall_subjust_type(t, t_start, class_name, file_name, paras, is_cpp);
-        tt.deref = deref;
-        return tt;
+        const TypeRef tt = recall_subjust_type(t, t_start, class_name, file_name, paras, is_cpp);
+        return _types.set_deref(tt, deref);
     } else {
         assert(false);
     }
 
+    return TYPE_OTHER;
 }
 // //回溯寻找type是否在分析的代码模块中
 bool Obfuscator::is_call_in_module(std::deque<Token>::iterator t, 
     const std::deque<Token>::iterator t_start, 
     const std::string& class_name, 
     const std::string& file_name, 
-    const std::map<std::string, Token>& paras,
+    const std::map<std::string, TypeRef>& paras,
     bool is_cpp, 
-    Token& fn_subject_type) {
+    TypeRef& fn_subject_type) {
 
-    fn_subject_type.type = CPP_OTHER;
+    fn_subject_type = TYPE_OTHER;
 
     const std::string fn_name = t->val;
     ///\ 1 查看是不是静态调用，如果是则返回false（之前已经将所有的类静态调用都设置成function了）
@@ -3481,7 +3761,7 @@ bool Obfuscator::is_call_in_module(std::deque<Token>::iterator t,
     if ((t-1)->type != CPP_POINTER && (t-1)->type != CPP_DOT) {
         ///\3 没有主语则匹配 全局函数 / 函数成员函数 / 或者局部函数(需要是cpp文件)
         
-        Token ret;
+        TypeRef ret;
         //1.1 匹配成员函数
         if (!class_name.empty()) {
             std::cerr << "class name is null if it's not global fn\n";
@@ -3491,7 +3771,7 @@ bool Obfuscator::is_call_in_module(std::deque<Token>::iterator t,
             if (is_in_class_struct(class_name, tm)) {
                 if(is_member_function(class_name, fn_name, ret)) {
                     std::cout << "is member fn\n";
-                    return !tm && !is_3th_base(class_name) && !is_ignore_class(class_name) && !is_ignore_class_function(class_name, fn_name);
+                    return _level == LEVEL_FULL && !tm && !is_3th_base(class_name) && !is_ignore_class(class_name) && !is_ignore_class_function(class_name, fn_name);
                 }
             } 
         }
@@ -3518,54 +3798,56 @@ bool Obfuscator::is_call_in_module(std::deque<Token>::iterator t,
 
         std::cerr << "fn dismatch, may 3th fn, or new construct\n";
         return false;
+    } else if (_level != LEVEL_FULL) {
+        //有主语的一定是成员函数调用, 只有full才替换
+        return false;
     } else {
-        Token fn_call_way = *(t-1);
+        const TokenType fn_call_way = (t-1)->type;
 
         --t;
         --t;
 
         std::cout << "begin to find subject's type\n";
 
-        Token t_type = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
+        TypeRef t_type = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
         std::cout  << class_name << "::" << fn_name << " called by " << t->val << " 's type: ";
-        print_token(t_type, std::cout);
+        _types.print(t_type, std::cout);
         std::cout << std::endl;
 
-        if (t_type.type != CPP_TYPE) {
+        if (_types.get(t_type).type != CPP_TYPE) {
             std::cout << "get invalid subject type.";
             return false;
         }
         
         //分析是不是迭代器
-        if (t_type.val == "iterator" || t_type.val == "const_iterator") {
-            assert(!t_type.ts.empty());
-            assert(!t_type.ts[0].ts.empty());
-            Token t_tmp = t_type.ts[0].ts[0];
-            t_type = t_tmp;
+        if (_types.val(t_type) == "iterator" || _types.val(t_type) == "const_iterator") {
+            assert(!_types.get(t_type).ts.empty());
+            assert(!_types.get(_types.child(t_type, 0)).ts.empty());
+            t_type = _types.child(_types.child(t_type, 0), 0);
         }
 
         //这里要分析是不是容器
-        if (is_stl_container(t_type.val)) {
-            if ((t_type.val == "shared_ptr" || t_type.val == "auto_ptr" || t_type.val == "unique_ptr") && fn_call_way.type == CPP_POINTER) {
-                Token ttt = t_type.ts[0];
-                t_type = ttt;
-            } else if (t_type.val == "weak_ptr") {
+        if (is_stl_container(_types.val(t_type))) {
+            if ((_types.val(t_type) == "shared_ptr" || _types.val(t_type) == "auto_ptr" || _types.val(t_type) == "unique_ptr") && fn_call_way == CPP_POINTER) {
+                t_type = _types.child(t_type, 0);
+            } else if (_types.val(t_type) == "weak_ptr") {
                 return false;
             } else {
                 //容器的其他方法，不解析
-                std::cout << "container: " << t_type.val << " fn: " << fn_name << ". ignore."; 
+                std::cout << "container: " << _types.val(t_type) << " fn: " << fn_name << ". ignore."; 
                 //assert(false);
                 return false;
             }
         }        
 
         bool tm = false;
-        if (is_in_class_struct(t_type.val, tm)) {
+        const std::string& c_name = _types.val(t_type);
+        if (is_in_class_struct(c_name, tm)) {
             fn_subject_type = t_type;
             if (tm) {
                return false; 
             } else {
-                return !is_3th_base(t_type.val) && !is_ignore_class(t_type.val) && !is_ignore_class_function(t_type.val, fn_name);
+                return !is_3th_base(c_name) && !is_ignore_class(c_name) && !is_ignore_class_function(c_name, fn_name);
             }
         } else {
             return false;
@@ -3578,9 +3860,9 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
     const std::deque<Token>::iterator t_end, 
     const std::string& class_name, 
     const std::string& file_name, 
-    const std::map<std::string, Token>& paras,
+    const std::map<std::string, TypeRef>& paras,
     bool is_cpp,
-    std::deque<Token>& ts) {
+    TokenStream& ts) {
     //过程调用的语法为 [主语[->/.]]function(paras)
     assert(t->type == CPP_OPEN_BRACE);
 
@@ -3591,7 +3873,7 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
             if (t->val == "set_id") {
                 std::cout << "got it 2";
             }
-            Token subject_t;
+            TypeRef subject_t;
             if ((t-1)->type == CPP_TYPE) {
                 std::cout << "may construct: " << (t-1)->type << " " << t->val << std::endl;
                 ++t;
@@ -3608,7 +3890,7 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
             
             auto t_r = t;
             ++t_r;
-            if(0 != jump_angle_brace(t_r, t_end)) {
+            if(0 != jump_angle_brace(t_r, t_end, ts)) {
                 //是小于号
                 ++t;
                 continue;
@@ -3617,7 +3899,7 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
             ++t_r;
             if (t_r->type == CPP_OPEN_PAREN) {
                 std::cout << "may call template fn : " << t->val << std::endl;
-                Token subject_t;
+                TypeRef subject_t;
                 if ((t-1)->type == CPP_TYPE) {
                     std::cout << "may construct: " << (t-1)->type << " " << t->val << std::endl;
                     ++t;
@@ -3634,7 +3916,7 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
         } else if(t->type == CPP_CLOSE_SQUARE && (t+1)->type == CPP_OPEN_PAREN) {
             //可能是lambda表达式, 跳过括号看下一个是否是{
             auto t_r = t+1;
-            std::map<std::string, Token> paras0 = label_skip_paren(t_r,ts);
+            std::map<std::string, TypeRef> paras0 = label_skip_paren(t_r,ts);
             if (t_r->type != CPP_OPEN_BRACE && t_r->type != CPP_POINTER) {
                 ++t;
                 continue;
@@ -3644,7 +3926,7 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
 
             //获取[]内的局部变量类型, 默认能获取class的成员
             auto t_p = t;
-            jump_before_square(t_p, t_start);
+            jump_before_square(t_p, t_start, ts);
             ++t_p;
             assert(t_p->type == CPP_OPEN_SQUARE);
             std::stack<Token> ssq;
@@ -3658,8 +3940,7 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
                     assert(false);
                 } else if (t_p->type == CPP_NAME) {
                     auto t_subject = t_p;
-                    Token tt = get_subject_type(t_subject, t_start, class_name, file_name, paras, is_cpp);
-                    paras0[t_p->val] = tt;
+                    paras0[t_p->val] = get_subject_type(t_subject, t_start, class_name, file_name, paras, is_cpp);
                     ++t_p;
                 } else {
                     ++t_p;
@@ -3682,91 +3963,216 @@ void Obfuscator::label_call_in_fn(std::deque<Token>::iterator t,
     }
 }
 
-void Obfuscator::label_call()  {
-    //1 先找到调用域(必须是函数域); TODO 其他域比如: 初始化列表中的调用, 全局/静态 变量的构造处调用等
-    //2 在函数域中寻找过程调用
-    //3 找主语
-    //   3.1 如果可以直接找到主语 a->fn(), 怎从全局变量 成员变量 参数表中寻找 type
-    //   3.2 如果是嵌套调用 fn1()->fn(), 则递归向前找fn1的返回值类型
-    //   3.3 如果找不到主语 fn(), 则判断是不是成员函数 或者 全局函数
-    //4 确定主语是混淆类中的元素, 则标记成call
+void Obfuscator::build_call_filter() {
+    size_t num = _g_functions.size();
+    for (auto it = _local_functions.begin(); it != _local_functions.end(); ++it) {
+        num += it->second.size();
+    }
+    for (auto it = _g_class_fn_with_base.begin(); it != _g_class_fn_with_base.end(); ++it) {
+        num += it->second.size();
+    }
+
+    _call_names.reset(num);
+    for (auto it = _g_functions.begin(); it != _g_functions.end(); ++it) {
+        _call_names.add(it->first);
+    }
+    for (auto it = _local_functions.begin(); it != _local_functions.end(); ++it) {
+        for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+            _call_names.add(it2->first);
+        }
+    }
+    for (auto it = _g_class_fn_with_base.begin(); it != _g_class_fn_with_base.end(); ++it) {
+        for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
+            _call_names.add(it2->fn_name);
+        }
+    }
+}
 
+bool Obfuscator::may_call_in_module(std::deque<Token>::iterator t_begin, std::deque<Token>::iterator t_end) {
+    //label_call_in_fn只会把 CPP_NAME 标记成调用, 函数体内没有模块内函数名则不用分析
+    for (auto t = t_begin; t <= t_end; ++t) {
+        if (t->type == CPP_NAME && _call_names.may_contain(t->val)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Obfuscator::build_fn_bodies() {
+    //找到所有函数定义的函数体, label的各个阶段共用
+    _fn_bodies.clear();
     int file_idx=0;
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
         const std::string file_name = _file_name[file_idx++];
-        bool is_cpp = is_source_file(file_name);
-
-        std::cout << "label file: " << file_name << std::endl;
-        if (file_name == "mi_be_operation_fe_app_init_bone_tumor.cpp") {
-            std::cout << "got it";
-        }
-
-        std::deque<Token>& ts = lex._ts;        
+        _fn_bodies.push_back(std::vector<FnBody>());
+        std::vector<FnBody>& bodies = _fn_bodies.back();
 
-        for (auto t = ts.begin(); t != ts.end(); ) {
+        TokenStream& ts = lex._ts;        
+        for (auto t = token_begin(ts); t != token_end(ts); ) {
             auto it_n = t+1;
-            if (it_n == ts.end()) {
+            if ((t->type == CPP_FUNCTION || t->type == CPP_MEMBER_FUNCTION) && it_n->type == CPP_OPEN_PAREN) {
+                FnBody body;
+                body.name = t->val;
+                if (t->type == CPP_MEMBER_FUNCTION) {
+                    body.class_name = t->subject;
+                }
                 ++t;
-                continue;
-            }
-
-            if (t->type == CPP_FUNCTION && it_n->type == CPP_OPEN_PAREN) {                
-                std::string class_name = "";
 
                 //寻找()后有没有 {
-                const std::string fn_name = t->val;
-                ++t;
-                std::cout << "label call in fn: " << fn_name << std::endl;
-
-                std::map<std::string, Token> paras = label_skip_paren(t,ts);
+                body.paras = label_skip_paren(t,ts);
                 while(t->type != CPP_SEMICOLON && t->type != CPP_OPEN_BRACE) {
                     ++t;
                 }
-
                 if (t->type == CPP_SEMICOLON) {
-                    //全局函数声明
-                    std::cout << "global function decalartion: " << fn_name << std::endl;
+                    //函数声明
+                    std::cout << "function decalartion: " << body.name << std::endl;
                     ++t;
                     continue;
                 }
+
                 //这个{就是回溯的终点限制
-                std::cout << "label fn " << fn_name << std::endl;
-                auto t_begin = t;
+                body.begin = t - ts.begin();
                 jump_brace(t, ts);
-                label_call_in_fn(t_begin, t_begin, t, class_name, file_name, paras, is_cpp, ts);
-                
-            } else if (t->type == CPP_MEMBER_FUNCTION && it_n->type == CPP_OPEN_PAREN) {
-                //寻找()后有没有 {
-                const std::string fn_name = t->val;
-                const std::string class_name = t->subject;
+                body.end = t - ts.begin();
+                bodies.push_back(body);
+            } else {
                 ++t;
+            }
+        }
+        std::cout << "file: " << file_name << " has " << bodies.size() << " function bodies.\n";
+    }
+}
 
-                std::cout << "label call in class fn: " << fn_name << std::endl;
+void Obfuscator::label_call()  {
+    //1 先找到调用域(必须是函数域); TODO 其他域比如: 初始化列表中的调用, 全局/静态 变量的构造处调用等
+    //2 在函数域中寻找过程调用
+    //3 找主语
+    //   3.1 如果可以直接找到主语 a->fn(), 怎从全局变量 成员变量 参数表中寻找 type
+    //   3.2 如果是嵌套调用 fn1()->fn(), 则递归向前找fn1的返回值类型
+    //   3.3 如果找不到主语 fn(), 则判断是不是成员函数 或者 全局函数
+    //4 确定主语是混淆类中的元素, 则标记成call
+    //5 同一个函数体再标记作为参数的函数(必须在4之后, 已经标记成call的不再是CPP_NAME)
+
+    //label阶段不修改token流, 函数体的索引和主语类型在两种标记之间共用
+    _local_decls.clear();
+    _subject_types.clear();
+    _infer_steps.clear();
+    build_call_filter();
+    build_fn_bodies();
+    int fn_num = 0;
+    int fn_skip = 0;
+
+    for (size_t file_idx = 0; file_idx < _lex.size(); ++file_idx) {
+        Lex& lex = *_lex[file_idx];
+        const std::string& file_name = _file_name[file_idx];
+        const bool is_cpp = is_source_file(file_name);
+        TokenStream& ts = lex._ts;        
+        _label_ts = &ts;
 
-                std::map<std::string, Token> paras = label_skip_paren(t,ts);
-                while(t->type != CPP_SEMICOLON && t->type != CPP_OPEN_BRACE) {
-                    ++t;
-                }
-                if (t->type == CPP_SEMICOLON) {
-                    //类成员函数声明
-                    std::cout << "member function decalartion: " << fn_name << std::endl;
-                    ++t;
+        std::cout << "label file: " << file_name << std::endl;
+        const std::vector<FnBody>& bodies = _fn_bodies[file_idx];
+        for (auto it_b = bodies.begin(); it_b != bodies.end(); ++it_b) {
+            const FnBody& body = *it_b;
+            auto t_begin = ts.begin() + body.begin;
+            auto t_end = ts.begin() + body.end;
+            if (body.class_name.empty()) {
+                std::cout << "label fn " << body.name << std::endl;
+            } else {
+                std::cout << "label " << body.class_name << "::" << body.name << std::endl;
+            }
+
+            ++fn_num;
+            if (may_call_in_module(t_begin, t_end)) {
+                label_call_in_fn(t_begin, t_begin, t_end, body.class_name, file_name, body.paras, is_cpp, ts);
+            } else {
+                ++fn_skip;
+                std::cout << "no module call in fn: " << body.name << ", skip it.\n";
+            }
+            label_fn_as_para_in_fn(t_begin, t_begin, t_end, body.class_name, file_name, body.paras, is_cpp);
+        }
+    }
+    _label_ts = nullptr;
+
+    std::cout << "label call: skip " << fn_skip << "/" << fn_num << " function bodies without module call.\n";
+}
+
+//t_d是局部声明索引里的候选位置, 前面是类型时才确定是变量声明
+static inline bool is_typed_local_decl(std::deque<Token>::iterator t_d) {
+    auto t_p = t_d-1;
+    while (t_p->type == CPP_MULT || t_p->type == CPP_AND || t_p->type == CPP_AND_AND) {
+        --t_p;
+    }
+    return t_p->type == CPP_TYPE || t_p->val == "auto";
+}
+
+void Obfuscator::label_free_call() {
+    //declarations级别不推导类型, 只标记没有主语的全局/局部函数调用和作为参数的函数名
+    //有主语的都是成员函数调用, 这个级别不替换成员函数; 没有主语的成员函数调用在is_call_in_module中排除
+    _local_decls.clear();
+    build_fn_bodies();
+
+    for (size_t file_idx = 0; file_idx < _lex.size(); ++file_idx) {
+        Lex& lex = *_lex[file_idx];
+        const std::string& file_name = _file_name[file_idx];
+        const bool is_cpp = is_source_file(file_name);
+        TokenStream& ts = lex._ts;
+        _label_ts = &ts;
+
+        const std::vector<FnBody>& bodies = _fn_bodies[file_idx];
+        for (auto it_b = bodies.begin(); it_b != bodies.end(); ++it_b) {
+            const FnBody& body = *it_b;
+            auto t_begin = ts.begin() + body.begin;
+            auto t_end = ts.begin() + body.end;
+            for (auto t = t_begin+1; t < t_end; ++t) {
+                auto t_p = t-1;
+                if (t->type != CPP_NAME || t_p->type == CPP_DOT || t_p->type == CPP_POINTER || 
+                    t_p->type == CPP_SCOPE || t_p->type == CPP_TYPE) {
                     continue;
                 }
+                auto t_n = t+1;
+                if (t_n->type == CPP_LESS) {
+                    auto t_r = t_n;
+                    if (0 == jump_angle_brace(t_r, t_end, ts)) {
+                        t_n = t_r+1;
+                    }
+                }
 
-                //这个{就是回溯的终点限制
-                std::cout << "label " << class_name << "::" << fn_name << std::endl;
-
-                auto t_begin = t;
-                jump_brace(t, ts);
-                label_call_in_fn(t_begin, t_begin, t, class_name, file_name, paras, is_cpp, ts);
+                TypeRef ret;
+                if (t_n->type == CPP_OPEN_PAREN) {
+                    if (is_call_in_module(t, t_begin, body.class_name, file_name, body.paras, is_cpp, ret)) {
+                        t->type = CPP_CALL;
+                    }
+                    continue;
+                }
 
-            } else {
-                ++t;
+                //函数作为参数, 同名的参数/成员变量/局部变量优先
+                if (is_ignore_function(t->val) ||
+                    !(is_global_function(t->val, ret) || (is_cpp && is_local_function(file_name, t->val, ret))) ||
+                    body.paras.find(t->val) != body.paras.end() ||
+                    (!body.class_name.empty() && is_member_variable(body.class_name, t->val, ret))) {
+                    continue;
+                }
+                const LocalDeclIndex& index = get_local_decls(t_begin);
+                auto it_ds = index.decls.find(t->val);
+                bool is_var = false;
+                if (it_ds != index.decls.end()) {
+                    const int pos = t - t_begin;
+                    for (auto it_d = it_ds->second.begin(); it_d != it_ds->second.end() && it_d->pos <= pos; ++it_d) {
+                        if (pos <= it_d->end && is_typed_local_decl(t_begin + it_d->pos)) {
+                            is_var = true;
+                            break;
+                        }
+                    }
+                }
+                if (!is_var) {
+                    t->type = CPP_CALL;
+                }
             }
         }
     }
+    _label_ts = nullptr;
+    _local_decls.clear();
 }
 
 void Obfuscator::label_fn_as_para_in_fn(std::deque<Token>::iterator t, 
@@ -3774,7 +4180,7 @@ void Obfuscator::label_fn_as_para_in_fn(std::deque<Token>::iterator t,
     const std::deque<Token>::iterator t_end, 
     const std::string& class_name, 
     const std::string& file_name, 
-    const std::map<std::string, Token>& paras,
+    const std::map<std::string, TypeRef>& paras,
     bool is_cpp) {
     //过程调用的语法为 [主语[->/.]]function(paras)
     assert(t->type == CPP_OPEN_BRACE);
@@ -3782,17 +4188,17 @@ void Obfuscator::label_fn_as_para_in_fn(std::deque<Token>::iterator t,
     while(t<=t_end) {
         if (t->type == CPP_NAME && (t+1)->type != CPP_OPEN_PAREN) {//区别于函数调用
             std::cout << "may function : " << t->type << " as parameter\n";
-            Token ret;
+            TypeRef ret;
             if (is_global_function(t->val,ret) && !is_ignore_function(t->val)) {
                 //函数作为参数,前面一点要有引号
                 //判断name是不是和函数名重名的类型
-                Token tt = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
-                if (tt.type == CPP_OTHER) {
+                const TypeRef tt = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
+                if (tt == TYPE_OTHER) {
                     t->type = CPP_CALL;
                 }
             } else if (is_cpp && is_local_function(file_name, t->val , ret) && !is_ignore_function(t->val)) {
-                Token tt = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
-                if (tt.type == CPP_OTHER) {
+                const TypeRef tt = get_subject_type(t, t_start, class_name, file_name, paras, is_cpp);
+                if (tt == TYPE_OTHER) {
                     t->type = CPP_CALL;
                 }
             }
@@ -3801,174 +4207,361 @@ void Obfuscator::label_fn_as_para_in_fn(std::deque<Token>::iterator t,
     }
 }
 
-void Obfuscator::label_fn_as_parameter() {
-
-    int file_idx=0;
-    for (auto it = _lex.begin(); it != _lex.end(); ++it) {
-        Lex& lex = *(*it);
-        const std::string file_name = _file_name[file_idx++];
-        bool is_cpp = is_source_file(file_name);
-
-        std::cout << "label file: " << file_name << std::endl;
-        std::deque<Token>& ts = lex._ts;        
-
-        for (auto t = ts.begin(); t != ts.end(); ) {
-            auto it_n = t+1;
-            if (it_n == ts.end()) {
-                ++t;
-                continue;
-            }
-
-            if (t->type == CPP_FUNCTION && it_n->type == CPP_OPEN_PAREN) {                
-                std::string class_name = "";
-
-                //寻找()后有没有 {
-                const std::string fn_name = t->val;
-                ++t;
-                std::cout << "label function as parameter in fn: " << fn_name << std::endl;
-
-                std::map<std::string, Token> paras = label_skip_paren(t,ts);
-                while(t->type != CPP_SEMICOLON && t->type != CPP_OPEN_BRACE) {
-                    ++t;
-                }
-
-                if (t->type == CPP_SEMICOLON) {
-                    //全局函数声明
-                    std::cout << "global function decalartion: " << fn_name << std::endl;
-                    ++t;
-                    continue;
-                }
-                //这个{就是回溯的终点限制
-                std::cout << "label fn " << fn_name << std::endl;
-                auto t_begin = t;
-                jump_brace(t, ts);
-                label_fn_as_para_in_fn(t_begin, t_begin, t, class_name, file_name, paras, is_cpp);
-                
-            } else if (t->type == CPP_MEMBER_FUNCTION && it_n->type == CPP_OPEN_PAREN) {
-                //寻找()后有没有 {
-                const std::string fn_name = t->val;
-                const std::string class_name = t->subject;
-                ++t;
-
-                std::cout << "label function as parameter in class fn: " << fn_name << std::endl;
-
-                std::map<std::string, Token> paras = label_skip_paren(t,ts);
-                while(t->type != CPP_SEMICOLON && t->type != CPP_OPEN_BRACE) {
-                    ++t;
-                }
-                if (t->type == CPP_SEMICOLON) {
-                    //类成员函数声明
-                    std::cout << "member function decalartion: " << fn_name << std::endl;
-                    ++t;
-                    continue;
-                }
-
-                //这个{就是回溯的终点限制
-                std::cout << "label " << class_name << "::" << fn_name << std::endl;
-                auto t_begin = t;
-                jump_brace(t, ts);
-                label_fn_as_para_in_fn(t_begin, t_begin, t, class_name, file_name, paras, is_cpp);
-
-            } else {
-                ++t;
-            }
-        }
-    }
-
-}
-
-void Obfuscator::replace_call(bool hash) {
+void Obfuscator::collect_replace(ReplaceSet& replace_set) {
     //替换的内容
-    //所有的class名称, 所有的非模板类成员函数, 全局/局部函数, 所有的call, 
+    //所有的class名称, 所有的非模板类成员函数, 全局/局部函数, 所有的call, 按_level只取其中一部分
+    //多个宏配置时每个配置的结果都追加到replace_set里, 同一个loc重复的在写文件时去掉
 
     int file_idx=0;
-    const std::string REPLACE = "_replace";
-    const std::string RE_HEADER = "mi_";
-    _map_replace.clear();
-
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
         const std::string file_name = _file_name[file_idx];
         const std::string file_path = _file_path[file_idx];
         ++file_idx;
         std::cout << "replace file: " << file_name << std::endl;
-        std::deque<Token> to_be_replace;
+        std::vector<ReplaceRecord>& to_be_replace = replace_set.files[file_path];
         
         //1 把整合过的token中非模板非三方模块继承的类的member fn 以及局部和全局方程 以及 call 抽取出来
-        std::deque<Token>& ts = lex._ts;
-        for (auto t = ts.begin(); t != ts.end(); ++t) {
-            if ((t->type == CPP_CALL || t->type == CPP_FUNCTION) && t->val != "operator" && t->val != "main") { 
+        TokenStream& ts = lex._ts;
+        for (auto t = token_begin(ts); t != token_end(ts); ++t) {
+            if ((t->type == CPP_CALL || t->type == CPP_FUNCTION) && t->val != "operator" && t->val != "main" && _level >= LEVEL_DECLARATIONS) { 
                 if (t->type == CPP_FUNCTION) {
                     if (!is_ignore_function(t->val)) {
-                        to_be_replace.push_back(*t);    
+                        add_replace(replace_set, to_be_replace, *t);    
                     }
                 } else {
-                    to_be_replace.push_back(*t);
+                    add_replace(replace_set, to_be_replace, *t);
                 }
-            } else if (t->type == CPP_MEMBER_FUNCTION && t->val != "operator") {
+            } else if (t->type == CPP_MEMBER_FUNCTION && t->val != "operator" && _level == LEVEL_FULL) {
                 assert(!t->subject.empty());
                 bool tm=false;
                 if (is_in_class_struct(t->subject, tm) && !tm && !is_3th_base(t->subject) &&
                  !is_ignore_class(t->subject) && !is_ignore_class_function(t->subject, t->val)) {
-                    to_be_replace.push_back(*t);
+                    add_replace(replace_set, to_be_replace, *t);
                 }
             }
         }
 
         //2 生成原始token 并把非模板类的class名称全抽取出来
-        std::deque<Token>& stage_ts = lex._stage_ts;
-        for (auto t = stage_ts.begin(); t != stage_ts.end(); ++t) {
+        TokenStream& stage_ts = lex._stage_ts;
+        for (auto t = token_begin(stage_ts); t != token_end(stage_ts); ++t) {
             bool tm = false;
             if (t->type == CPP_NAME && is_in_class_struct(t->val, tm) && !tm && !is_ignore_class(t->val)) {
-                to_be_replace.push_back(*t);
+                add_replace(replace_set, to_be_replace, *t);
             }
         }
+    }
+}
 
-        if (to_be_replace.empty()) {
-            continue;
+void Obfuscator::prepare_replace(ReplaceSet& replace_set, bool hash, std::vector<std::string>& new_names, std::vector<uint64_t>& freq) {
+    //3 对这些loc进行排序，去掉重复替换的部分如析构函数这种, 统计每个名字的出现次数
+    freq.assign(replace_set.syms.size(), 0);
+    for (auto it_r = replace_set.files.begin(); it_r != replace_set.files.end(); ++it_r) {
+        std::vector<ReplaceRecord>& records = it_r->second;
+        radix_sort_by_loc(records);
+        size_t n = 0;
+        uint64_t last_end = 0;
+        for (size_t i = 0; i < records.size(); ++i) {
+            if (records[i].loc < 1 || records[i].loc-1 < last_end) {
+                continue;
+            }
+            last_end = records[i].loc-1 + records[i].len;
+            ++freq[records[i].sym];
+            records[n++] = records[i];
         }
+        records.resize(n);
+    }
 
-        //3 对这些loc进行排序，然后按loc从小到大替换
-        std::sort(to_be_replace.begin(), to_be_replace.end(), [](Token& l, Token& r) {
-            return l.loc < r.loc;
-        });
-        
-        ///4 替换
-        int loc_sum = 0;
-        std::string code = lex._reader->_file_str;
-        int last_loc = -1;
-        if (hash) {
-            for (auto t = to_be_replace.begin(); t != to_be_replace.end(); ++t) {
-                int loc = t->loc;
-                int len = t->val.size();
-                if (last_loc == loc) {
-                    continue;//去掉重复替换的部分如析构函数这种
-                }
-                last_loc = loc;
-                std::string v_old = t->val;
-                std::string v_new = RE_HEADER + Util::hash(v_old);
-                _map_replace[v_old] = v_new;
-                //先删除
-                code.replace(loc+loc_sum-1, len, v_new);
-                loc_sum += v_new.size() - v_old.size(); 
+    //所有不同的名字一次算好新名字
+    new_names.clear();
+    if (hash && _hash_mode == HASH_SHORT) {
+        short_symbols(replace_set.syms, freq, new_names);
+    } else if (hash) {
+        hash_symbols(replace_set.syms, new_names);
+    }
+}
+
+void Obfuscator::rewrite_code(const std::string& code, const std::vector<ReplaceRecord>& to_be_replace, bool hash,
+    const std::vector<std::string>& new_names, std::string& out_code, SourceMap& smap, std::vector<bool>& used) {
+    const std::string REPLACE = "_replace";
+
+    ///4 顺序扫描一遍原文件, 按loc从小到大边拷贝边替换
+    out_code.clear();
+    out_code.reserve(code.size() + to_be_replace.size()*(hash ? 40 : REPLACE.size()));
+    size_t cur = 0;
+    //source map: 替换不跨行, 只需要跟踪原文件和新文件里当前行的起点
+    uint32_t line = 1;
+    size_t line_begin = 0;
+    size_t out_line_begin = 0;
+    for (auto t = to_be_replace.begin(); t != to_be_replace.end(); ++t) {
+        const size_t begin = t->loc-1;
+        const size_t end = begin + t->len;
+        if (end > code.size()) {
+            continue;
+        }
+        for (size_t p = cur; p < begin; ++p) {
+            if (code[p] == '\n') {
+                ++line;
+                line_begin = p+1;
+                out_line_begin = out_code.size() + (p+1-cur);
             }
+        }
+        const size_t out_begin = out_code.size() + (begin-cur);
+        if (hash) {
+            out_code.append(code, cur, begin-cur);
+            out_code += new_names[t->sym];
+            used[t->sym] = true;
         } else {
-            for (auto t = to_be_replace.begin(); t != to_be_replace.end(); ++t) {
-                int loc = t->loc;
-                int len = t->val.size();
-                if (last_loc == loc) {
-                    continue;//去掉重复替换的部分如析构函数这种
+            out_code.append(code, cur, end-cur);
+            out_code += REPLACE;
+        }
+        cur = end;
+        smap.add(line, out_begin-out_line_begin+1, begin-line_begin+1, true);
+        smap.add(line, out_code.size()-out_line_begin+1, end-line_begin+1, false);
+    }
+    out_code.append(code, cur, std::string::npos);
+}
+
+void Obfuscator::write_replace(ReplaceSet& replace_set, bool hash) {
+    _map_replace.clear();
+
+    std::vector<std::string> new_names;
+    std::vector<uint64_t> freq;
+    prepare_replace(replace_set, hash, new_names, freq);
+
+    std::vector<bool> used(replace_set.syms.size(), false);
+    for (size_t file_idx = 0; file_idx < _lex.size(); ++file_idx) {
+        Lex& lex = *(_lex[file_idx]);
+        const std::string file_path = _file_path[file_idx];
+        auto it_r = replace_set.files.find(file_path);
+        if (it_r == replace_set.files.end() || it_r->second.empty()) {
+            continue;
+        }
+
+        std::string out_code;
+        SourceMap smap;
+        rewrite_code(lex._reader->_file_str, it_r->second, hash, new_names, out_code, smap, used);
+
+        //输出目录里的文件可能是以前运行留下的原文件的硬链接, 先删掉再写
+        const std::string& out_path = _out_path[file_idx];
+        if (out_path != file_path) {
+            Util::make_parent_dir(out_path);
+            remove(out_path.c_str());
+        }
+        std::ofstream out(out_path, std::ios::out);
+        out << out_code;
+        out.close();
+
+        if (!smap.save(out_path + ".l1map")) {
+            std::cerr << "err to open: " << out_path << ".l1map\n";
+        }
+    }
+
+    for (size_t i = 0; i < used.size(); ++i) {
+        if (used[i]) {
+            _map_replace[replace_set.syms[i]] = new_names[i];
+        }
+    }
+}
+
+void Obfuscator::write_patch(ReplaceSet& replace_set, bool hash, const std::string& debug_out) {
+    //不写源文件, 把所有的修改输出成一个unified diff, 并统计每个名字和每个文件的替换次数
+    //替换不跨行, 新旧文件的行一一对应, 逐行比较即可
+    const size_t CONTEXT = 3;
+
+    std::vector<std::string> new_names;
+    std::vector<uint64_t> freq;
+    prepare_replace(replace_set, hash, new_names, freq);
+
+    const std::string f_patch = debug_out + "/patch";
+    std::ofstream patch(f_patch, std::ios::out);
+    if (!patch.is_open()) {
+        std::cerr << "err to open: " << f_patch << "\n";
+        return;
+    }
+    const std::string f_count = debug_out + "/replace_count";
+    std::ofstream count(f_count, std::ios::out);
+    if (!count.is_open()) {
+        std::cerr << "err to open: " << f_count << "\n";
+        return;
+    }
+
+    std::vector<bool> used(replace_set.syms.size(), false);
+    size_t total_replace = 0;
+    size_t total_file = 0;
+    count << "#file\treplace\tlines\n";
+    for (size_t file_idx = 0; file_idx < _lex.size(); ++file_idx) {
+        Lex& lex = *(_lex[file_idx]);
+        const std::string file_path = _file_path[file_idx];
+        auto it_r = replace_set.files.find(file_path);
+        if (it_r == replace_set.files.end() || it_r->second.empty()) {
+            continue;
+        }
+
+        const std::string& code = lex._reader->_file_str;
+        std::string out_code;
+        SourceMap smap;
+        rewrite_code(code, it_r->second, hash, new_names, out_code, smap, used);
+
+        std::vector<std::string> old_lines;
+        std::vector<std::string> new_lines;
+        split_lines(code, old_lines);
+        split_lines(out_code, new_lines);
+        if (old_lines.size() != new_lines.size()) {
+            std::cerr << "line mismatch after replace: " << file_path << "\n";
+            continue;
+        }
+        std::vector<size_t> changed;
+        for (size_t i = 0; i < old_lines.size(); ++i) {
+            if (old_lines[i] != new_lines[i]) {
+                changed.push_back(i);
+            }
+        }
+        if (changed.empty()) {
+            continue;
+        }
+
+        patch << "--- " << file_path << "\n";
+        patch << "+++ " << _out_path[file_idx] << "\n";
+        for (size_t c = 0; c < changed.size(); ) {
+            //相邻的修改之间不超过2*CONTEXT行时合成一个hunk
+            size_t c_end = c+1;
+            while (c_end < changed.size() && changed[c_end] - changed[c_end-1] <= 2*CONTEXT) {
+                ++c_end;
+            }
+            const size_t begin = changed[c] > CONTEXT ? changed[c] - CONTEXT : 0;
+            const size_t end = std::min(old_lines.size(), changed[c_end-1] + CONTEXT + 1);
+            const size_t n = end - begin;
+            patch << "@@ -" << begin+1 << "," << n << " +" << begin+1 << "," << n << " @@\n";
+            size_t k = c;
+            for (size_t i = begin; i < end; ++i) {
+                if (k < c_end && changed[k] == i) {
+                    patch << "-" << old_lines[i] << "\n";
+                    patch << "+" << new_lines[i] << "\n";
+                    ++k;
+                } else {
+                    patch << " " << old_lines[i] << "\n";
                 }
-                last_loc = loc;
-                code.insert(loc+len+loc_sum-1, REPLACE);
-                loc_sum += REPLACE.length();
             }
+            c = c_end;
         }
 
-        std::ofstream out(file_path, std::ios::out);
-        out << code;
-        out.close();
+        count << file_path << "\t" << it_r->second.size() << "\t" << changed.size() << "\n";
+        total_replace += it_r->second.size();
+        ++total_file;
+    }
+    patch.close();
+
+    //名字按替换次数从多到少
+    std::vector<size_t> order;
+    for (size_t i = 0; i < freq.size(); ++i) {
+        if (freq[i] > 0) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](size_t l, size_t r) {
+        return freq[l] != freq[r] ? freq[l] > freq[r] : replace_set.syms[l] < replace_set.syms[r];
+    });
+    count << "#symbol\tnew\treplace\n";
+    for (auto it = order.begin(); it != order.end(); ++it) {
+        count << replace_set.syms[*it] << "\t" << (hash ? new_names[*it] : replace_set.syms[*it] + "_replace") << "\t" << freq[*it] << "\n";
+    }
+    count.close();
+
+    std::cout << "dry run: " << total_replace << " replaces of " << order.size() << " symbols in " << total_file << " files, see " << f_patch << std::endl;
+}
+
+void Obfuscator::short_symbols(const std::vector<std::string>& syms, const std::vector<uint64_t>& freq, std::vector<std::string>& names) {
+    //源码里出现过的名字(包括宏定义里的)都不能用, 否则会和局部变量, 参数, 三方库的名字冲突
+    std::unordered_set<std::string> used_names;
+    std::function<void(const std::deque<Token>&)> collect_names = [&](const std::deque<Token>& ts) {
+        for (auto it = ts.begin(); it != ts.end(); ++it) {
+            if (!it->val.empty() && (isalpha(it->val[0]) || it->val[0] == '_')) {
+                used_names.insert(it->val);
+            }
+            if (!it->ts.empty()) {
+                collect_names(it->ts);
+            }
+        }
+    };
+    for (auto it = _lex.begin(); it != _lex.end(); ++it) {
+        collect_names((*it)->_stage_ts.tokens());
+    }
+    //映射库里的名字保持不变, 新的名字也不能和它们重复
+    for (auto it = _mapping_db.begin(); it != _mapping_db.end(); ++it) {
+        if (used_names.find(it->second) != used_names.end()) {
+            std::cerr << "mapping db name conflicts with source: " << it->first << " -> " << it->second << std::endl;
+        }
+    }
+    for (auto it = _mapping_db.begin(); it != _mapping_db.end(); ++it) {
+        used_names.insert(it->second);
+    }
+
+    //出现次数多的先分配, 次数相同按名字排序, 保证结果确定
+    std::vector<size_t> order(syms.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t l, size_t r) {
+        return freq[l] != freq[r] ? freq[l] > freq[r] : syms[l] < syms[r];
+    });
+
+    names.resize(syms.size());
+    uint64_t n = 0;
+    int reuse_num = 0;
+    for (auto it = order.begin(); it != order.end(); ++it) {
+        auto it_db = _mapping_db.find(syms[*it]);
+        if (it_db != _mapping_db.end()) {
+            names[*it] = it_db->second;
+            ++reuse_num;
+            continue;
+        }
+        std::string v_new;
+        do {
+            v_new = Util::base62_name(n++);
+        } while (Lex::is_reserved(v_new) || is_reserved_c_name(v_new) || is_macro_like_name(v_new) ||
+            used_names.find(v_new) != used_names.end());
+        names[*it] = v_new;
+    }
+    std::cout << "short name " << syms.size() << " symbols, " << reuse_num << " from mapping db, last name: " << (n > 0 ? Util::base62_name(n-1) : "") << std::endl;
+}
+
+void Obfuscator::hash_symbols(const std::vector<std::string>& syms, std::vector<std::string>& names) {
+    const std::string RE_HEADER = "mi_";
+    names.resize(syms.size());
+    //混淆名 -> 符号下标, 检查整个符号集合里的冲突
+    std::unordered_map<std::string, size_t> owners;
+    owners.reserve(syms.size()*2);
+    int collision_num = 0;
+    //映射库里的名字都已经占用
+    std::unordered_set<std::string> taken;
+    for (auto it = _mapping_db.begin(); it != _mapping_db.end(); ++it) {
+        taken.insert(it->second);
+    }
+    int reuse_num = 0;
+    for (size_t i = 0; i < syms.size(); ++i) {
+        auto it_db = _mapping_db.find(syms[i]);
+        if (it_db != _mapping_db.end()) {
+            names[i] = it_db->second;
+            ++reuse_num;
+            continue;
+        }
+        std::string v_new;
+        for (int salt = 0; ; ++salt) {
+            //冲突时加盐重新hash, 结果仍然是确定的
+            const std::string v = salt == 0 ? syms[i] : syms[i] + "#" + std::to_string(salt);
+            v_new = RE_HEADER + (_hash_mode == HASH_SIP ? Util::sip_hash(v, _hash_key) : Util::hash(v));
+            auto it = owners.find(v_new);
+            if (it == owners.end() && taken.find(v_new) == taken.end()) {
+                break;
+            }
+            ++collision_num;
+            std::cerr << "hash collision: " << syms[i] << " and " << (it != owners.end() ? syms[it->second] : "mapping db") << " -> " << v_new << std::endl;
+        }
+        owners[v_new] = i;
+        names[i] = v_new;
     }
+    std::cout << "hash " << syms.size() << " symbols, " << reuse_num << " from mapping db, " << collision_num << " collisions." << std::endl;
 }
 
 void Obfuscator::set_ignore_class(const std::set<std::string>& c_names) {
@@ -3983,6 +4576,24 @@ void Obfuscator::set_ignore_class_function(const std::map<std::string, std::set<
     _ignore_c_fn_name = c_fn_name;
 }
 
+void Obfuscator::set_predefined_marco(const std::vector<Token>& marcos) {
+    _predefined_marco = marcos;
+}
+
+void Obfuscator::set_hash(HashMode mode, const uint64_t key[2]) {
+    _hash_mode = mode;
+    _hash_key[0] = key[0];
+    _hash_key[1] = key[1];
+}
+
+void Obfuscator::set_level(ObfuscateLevel level) {
+    _level = level;
+}
+
+void Obfuscator::set_infer_budget(int budget) {
+    _infer_budget = budget;
+}
+
 bool Obfuscator::is_ignore_class(const std::string& c_name) {
     const bool ig = _ignore_c_name.find(c_name) != _ignore_c_name.end();
     return ig;
@@ -4002,11 +4613,76 @@ bool Obfuscator::is_ignore_class_function(const std::string& c_name, const std::
     return false;
 }
 
+int Obfuscator::load_mapping_db(const std::string& f) {
+    //第一行是 #mode <md5|sip|short>, 后面每行 原名\t新名字, 只追加不修改
+    //不同hash方式分配的名字不能混用
+    _mapping_db.clear();
+    _mapping_db_path = f;
+    std::ifstream in(f, std::ios::in);
+    if (!in.is_open()) {
+        return 0;
+    }
+    const std::string header = std::string("#mode ") + mapping_db_mode(_hash_mode);
+    std::string line;
+    int line_num = 0;
+    while(std::getline(in, line)) {
+        ++line_num;
+        if (line.empty()) {
+            continue;
+        }
+        if (line[0] == '#') {
+            if (line.compare(0, 6, "#mode ") == 0 && line != header) {
+                std::cerr << "mapping db " << f << " is " << line.substr(6) << " mode, but run in " << mapping_db_mode(_hash_mode) << " mode.\n";
+                return -1;
+            }
+            continue;
+        }
+        const size_t tab = line.find('\t');
+        if (tab == std::string::npos || tab == 0 || tab+1 == line.size()) {
+            std::cerr << "invalid mapping db line " << line_num << ": " << line << "\n";
+            return -1;
+        }
+        //同一个原名取第一次的
+        _mapping_db.insert(std::make_pair(line.substr(0, tab), line.substr(tab+1)));
+    }
+    in.close();
+
+    std::cout << "load mapping db: " << _mapping_db.size() << " symbols." << std::endl;
+    return 0;
+}
+
+void Obfuscator::save_mapping_db() {
+    if (_mapping_db_path.empty()) {
+        return;
+    }
+    const bool is_new = !std::ifstream(_mapping_db_path).good();
+    std::ofstream out(_mapping_db_path, std::ios::out | std::ios::app);
+    if (!out.is_open()) {
+        std::cerr << "err to open: " << _mapping_db_path << "\n";
+        return;
+    }
+    if (is_new) {
+        out << "#mode " << mapping_db_mode(_hash_mode) << "\n";
+    }
+    //只追加这次新分配的名字
+    int add_num = 0;
+    for (auto it = _map_replace.begin(); it != _map_replace.end(); ++it) {
+        if (_mapping_db.find(it->first) == _mapping_db.end()) {
+            out << it->first << "\t" << it->second << "\n";
+            _mapping_db[it->first] = it->second;
+            ++add_num;
+        }
+    }
+    out.close();
+
+    std::cout << "save mapping db: add " << add_num << " symbols." << std::endl;
+}
+
 void Obfuscator::debug(const std::string& debug_out) {
     size_t i=0;
     for (auto it = _lex.begin(); it != _lex.end(); ++it) {
         Lex& lex = *(*it);
-        const std::string& file_name = _file_path[i++];
+        const std::string& file_name = _out_path[i++];
         const std::string f = file_name +".l1";
         std::cout << "print file token: " << file_name << std::endl;
         std::ofstream out(f, std::ios::out);
@@ -4015,8 +4691,8 @@ void Obfuscator::debug(const std::string& debug_out) {
             continue;
         }
 
-        const std::deque<Token>& ts = lex._ts;
-        for (auto it2=ts.begin(); it2!=ts.end(); ++it2) {
+        const TokenStream& ts = lex._ts;
+        for (auto it2=token_begin(ts); it2!=token_end(ts); ++it2) {
             const Token& t = *it2;
             out << t.type << ": ";
 
@@ -4035,7 +4711,8 @@ void Obfuscator::debug(const std::string& debug_out) {
             std::cerr << "err to open: " << f << "\n";
             return;
         }
-        for (auto it = _g_marco.begin(); it != _g_marco.end(); ++it) { 
+        const std::vector<Token>& marcos = _g_marco.all();
+        for (auto it = marcos.begin(); it != marcos.end(); ++it) { 
             out << (*it).val << ": ";
             for (auto it2 = (*it).ts.begin(); it2 != (*it).ts.end(); ++it2) {
             out << (*it2).val << " "; 
@@ -4066,7 +4743,7 @@ void Obfuscator::debug(const std::string& debug_out) {
                 for (size_t j=0; j<c.tm_paras_list.size(); ++j) {
                     auto tj = c.tm_paras.find(c.tm_paras_list[j]);
                     assert (tj != c.tm_paras.end());
-                    print_token(tj->second, out);
+                    _types.print(tj->second, out);
                     if (j != c.tm_paras_list.size()-1) {
                         out << " , ";
                     }
@@ -4074,7 +4751,7 @@ void Obfuscator::debug(const std::string& debug_out) {
                 out << "> ";
             }
         
-            out << c.scope.key << "::" << c.name;
+            out << _scopes[c.scope].key << "::" << c.name;
             if (!c.father.empty()) {
                 out << " public : " << c.father;
             }
@@ -4085,7 +4762,7 @@ void Obfuscator::debug(const std::string& debug_out) {
             auto it_c = _g_class_childs.find(c_name);
             if (it_c != _g_class_childs.end()) {
                 for (auto it_cc = it_c->second.begin(); it_cc != it_c->second.end(); ++it_cc) {
-                    out << it_cc->second.scope.key << "::" <<it_cc->second.name << " ";
+                    out << _scopes[it_cc->second.scope].key << "::" <<it_cc->second.name << " ";
                 }
             }
 
@@ -4094,7 +4771,7 @@ void Obfuscator::debug(const std::string& debug_out) {
             auto it_b = _g_class_bases.find(c_name);
             if (it_b != _g_class_bases.end()) {
                 for (auto it_bc = it_b->second.begin(); it_bc != it_b->second.end(); ++it_bc) {
-                    out << it_bc->second.scope.key << "::" <<it_bc->second.name << " ";
+                    out << _scopes[it_bc->second.scope].key << "::" <<it_bc->second.name << " ";
                 }
             }
 
@@ -4129,7 +4806,7 @@ void Obfuscator::debug(const std::string& debug_out) {
                 }
 
                 out << "\t ret: ";
-                print_token(cf.ret, out);
+                _types.print(cf.ret, out);
 
                 out << std::endl;
             }
@@ -4149,7 +4826,7 @@ void Obfuscator::debug(const std::string& debug_out) {
             for (auto it = it0->second.begin(); it != it0->second.end(); ++it) {
                 const ClassVariable& cf = *it;
                 out << cf.c_name << "::" << cf.m_name << "\ttype: ";
-                print_token(cf.type, out);
+                _types.print(cf.type, out);
                 out << std::endl;
             }
         }
@@ -4201,8 +4878,8 @@ void Obfuscator::debug(const std::string& debug_out) {
             return;
         }
         for (auto it = _g_variable.begin(); it != _g_variable.end(); ++it) {
-            out << it->second.scope.key << "::" <<  it->first << " type: ";
-            print_token(it->second.type, out);
+            out << _scopes[it->second.scope].key << "::" <<  it->first << " type: ";
+            _types.print(it->second.type, out);
             out << std::endl;
         }
         out.close();
@@ -4217,8 +4894,8 @@ void Obfuscator::debug(const std::string& debug_out) {
             return;
         }
         for (auto it_f = _g_functions.begin(); it_f != _g_functions.end(); ++it_f) {
-            out << it_f->second.scope.key << "::" << it_f->first <<  " ret: ";
-            print_token(it_f->second.ret, out);
+            out << _scopes[it_f->second.scope].key << "::" << it_f->first <<  " ret: ";
+            _types.print(it_f->second.ret, out);
             out << std::endl;
         }
         out.close();
@@ -4239,7 +4916,7 @@ void Obfuscator::debug(const std::string& debug_out) {
             }
             for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
                 out << "\t" << it2->first << " type: ";
-                print_token(it2->second.type, out);
+                _types.print(it2->second.type, out);
                 out << " \n"; 
             }
         }
@@ -4261,7 +4938,7 @@ void Obfuscator::debug(const std::string& debug_out) {
             }
             for (auto it2 = it->second.begin(); it2 != it->second.end(); ++it2) {
                 out << "\t" << it2->first << " ret: ";
-                print_token(it2->second.ret, out);
+                _types.print(it2->second.ret, out);
                 out << " \n"; 
             }
         }
@@ -4276,6 +4953,10 @@ void Obfuscator::debug(const std::string& debug_out) {
             std::cerr << "err to open: " << f << "\n";
             return;
         }
+        //短名字会和普通的单词重名, l1d看到这一行会拒绝还原
+        if (_hash_mode == HASH_SHORT) {
+            out << "#mode " << mapping_db_mode(_hash_mode) << std::endl;
+        }
         for (auto it = _map_replace.begin(); it != _map_replace.end(); ++it) {
             out << it->first << "\t" << it->second << std::endl;
         }
@@ -4283,29 +4964,73 @@ void Obfuscator::debug(const std::string& debug_out) {
     }
 }
 
-bool Obfuscator::is_in_marco(const std::string& m) {
-    for (auto it=_g_marco.begin(); it != _g_marco.end(); ++it) {
-        if (!(*it).ts.empty()) {
-            if((*it).ts.front().val == m) {
-                return true;
-            }
+void Obfuscator::write_version_script(const std::string& f, const std::set<std::string>& public_api) {
+    //GNU ld version script: 混淆过的名字除了公开的API都是local, 没有匹配的符号保持默认的导出
+    //extern "C++"里匹配的是demangle之后的名字, 带引号的是精确匹配, 所以用不带引号的glob,
+    //ld的脚本里不能写(和空格, 用[!a-zA-Z0-9_]限定名字的结尾, 用?代替空格, 短名字也不会误匹配.
+    //参数里带有隐藏类型的函数也会被匹配到, 公开的API不能用隐藏的类型做参数
+    std::ofstream out(f, std::ios::out);
+    if (!out.is_open()) {
+        std::cerr << "err to open: " << f << "\n";
+        return;
+    }
+
+    const std::string END = "[!a-zA-Z0-9_]*;\n";
+    int hidden_num = 0;
+    out << "{\n";
+    out << "  local:\n";
+    out << "    extern \"C++\" {\n";
+    for (auto it = _map_replace.begin(); it != _map_replace.end(); ++it) {
+        if (public_api.find(it->first) != public_api.end()) {
+            continue;
         }
+        const std::string& n = it->second;
+        //函数, 类的成员
+        out << "      " << n << END;
+        out << "      *::" << n << END;
+        //类的元信息
+        out << "      vtable?for?" << n << ";\n";
+        out << "      vtable?for?*::" << n << ";\n";
+        out << "      typeinfo?for?" << n << ";\n";
+        out << "      typeinfo?for?*::" << n << ";\n";
+        out << "      typeinfo?name?for?" << n << ";\n";
+        out << "      typeinfo?name?for?*::" << n << ";\n";
+        ++hidden_num;
     }
+    out << "    };\n";
+    out << "};\n";
+    out.close();
 
-    return false;
+    std::cout << "version script: hide " << hidden_num << " symbols, keep " << _map_replace.size() - hidden_num << " public symbols." << std::endl;
 }
 
-bool Obfuscator::is_in_marco(const std::string& m, Token& val) {
-    for (auto it=_g_marco.begin(); it != _g_marco.end(); ++it) {
-        if (!(*it).ts.empty()) {
-            if((*it).ts.front().val == m) {
-                val = *it;
-                return true;
-            }
+int Obfuscator::eval_condition(const Token& t, const CondExpr::MacroLookup& lookup) {
+    //1 成立, 0 不成立, -1 不能判断
+    if (t.val == "else") {
+        return 1;
+    } else if (t.val == "ifdef" || t.val == "ifndef") {
+        if (t.ts.empty()) {
+            return -1;
         }
+        Token m;
+        const int found = lookup(t.ts[0].val, m);
+        if (found < 0) {
+            return -1;
+        }
+        return (t.val == "ifdef") == (found == 1) ? 1 : 0;
+    } else if (t.val == "if" || t.val == "elif") {
+        CondExpr expr(lookup);
+        return expr.eval(t.ts);
     }
+    return -1;
+}
 
-    return false;
+bool Obfuscator::is_in_marco(const std::string& m) {
+    return _g_marco.find(m);
+}
+
+bool Obfuscator::is_in_marco(const std::string& m, Token& val) {
+    return _g_marco.find(m, val);
 }
 
 bool Obfuscator::is_in_class_struct(const std::string& name, bool& tm) {
@@ -4324,6 +5049,13 @@ bool Obfuscator::is_in_typedef(const std::string& name) {
 }
 
 bool Obfuscator::is_in_typedef(const std::string& name, Token& t_type) {
+    //优先返回规范类型
+    auto it_c = _typedef_canonical.find(name);
+    if (it_c != _typedef_canonical.end()) {
+        t_type = it_c->second;
+        return true;
+    }
+
     auto it = _typedef_map.find(name);
     if (it != _typedef_map.end()) {
         t_type = it->second;
@@ -4347,12 +5079,12 @@ bool Obfuscator::is_member_function(const std::string& c_name, const std::string
     return false;
 }
 
-bool Obfuscator::is_member_function(const std::string& c_name, const std::string& fn_name, Token& ret) {
+bool Obfuscator::is_member_function(const std::string& c_name, const std::string& fn_name, TypeRef& ret) {
     auto it_fns = _g_class_fn_with_base.find(c_name);
     if (it_fns == _g_class_fn_with_base.end()) {
         return false;
     }
-    std::vector<ClassFunction> fns = it_fns->second;
+    const std::vector<ClassFunction>& fns = it_fns->second;
     for (auto it = fns.begin(); it != fns.end(); ++it) {
         if (it->fn_name == fn_name){
             ret = it->ret;
@@ -4363,7 +5095,7 @@ bool Obfuscator::is_member_function(const std::string& c_name, const std::string
     return false;
 }
 
-bool Obfuscator::is_member_variable(const std::string& c_name, const std::string& c_v_name, Token& t_type) {
+bool Obfuscator::is_member_variable(const std::string& c_name, const std::string& c_v_name, TypeRef& t_type) {
     auto it_c_vs = _g_class_variable_with_base.find(c_name);
     if (it_c_vs != _g_class_variable_with_base.end()) {
         for (auto it_v = it_c_vs->second.begin(); it_v != it_c_vs->second.end(); ++it_v) {
@@ -4377,16 +5109,17 @@ bool Obfuscator::is_member_variable(const std::string& c_name, const std::string
     return false;
 }
 
-std::map<std::string, Token> Obfuscator::get_template_class_type_paras(std::string c_name) {
+const std::map<std::string, TypeRef>& Obfuscator::get_template_class_type_paras(const std::string& c_name) {
+    static const std::map<std::string, TypeRef> empty_paras;
     auto it_c = _g_class.find(c_name);
     if (it_c != _g_class.end()) {
         return it_c->second.tm_paras;
     } else {
-        return std::map<std::string, Token>();
+        return empty_paras;
     }
 }
 
-bool Obfuscator::is_global_variable(const std::string& v_name, Token& t_type) {
+bool Obfuscator::is_global_variable(const std::string& v_name, TypeRef& t_type) {
     auto it_v = _g_variable.find(v_name);
     if (it_v != _g_variable.end()) {
         t_type = it_v->second.type;
@@ -4396,7 +5129,7 @@ bool Obfuscator::is_global_variable(const std::string& v_name, Token& t_type) {
     return false;
 }
 
-bool Obfuscator::is_local_variable(const std::string& file_name, const std::string& v_name, Token& ret_type) {
+bool Obfuscator::is_local_variable(const std::string& file_name, const std::string& v_name, TypeRef& ret_type) {
     auto it_vs = _local_variable.find(file_name);
     if(it_vs != _local_variable.end()) {
         auto it_v = it_vs->second.find(v_name);
@@ -4409,7 +5142,7 @@ bool Obfuscator::is_local_variable(const std::string& file_name, const std::stri
     return false;
 }
 
-bool Obfuscator::is_local_function(const std::string& file_name, const std::string& fn_name, Token& ret_type) {
+bool Obfuscator::is_local_function(const std::string& file_name, const std::string& fn_name, TypeRef& ret_type) {
     auto it_fns = _local_functions.find(file_name);
     if(it_fns != _local_functions.end()) {
         auto it_fn = it_fns->second.find(fn_name);
@@ -4422,7 +5155,7 @@ bool Obfuscator::is_local_function(const std::string& file_name, const std::stri
     return false;
 }
 
-bool Obfuscator::is_global_function(const std::string& fn_name, Token& ret) {
+bool Obfuscator::is_global_function(const std::string& fn_name, TypeRef& ret) {
     auto it_fn = _g_functions.find(fn_name);
     if (it_fn != _g_functions.end()) {
         ret = it_fn->second.ret;
@@ -3,17 +3,48 @@
 
 #include "common.h"
 #include "lex.h"
+#include "type_pool.h"
+#include "marco_table.h"
+#include "cond_expr.h"
+#include "source_map.h"
+#include "util.h"
+
+//一处替换: 源码中的位置(从1开始), 原名的长度, 原名在符号表中的下标
+struct ReplaceRecord {
+    uint32_t loc;
+    uint32_t len;
+    uint32_t sym;
+};
+
+//每个文件(路径)要替换的位置, 多个宏配置的结果合并在一起
+struct ReplaceSet {
+    std::vector<std::string> syms;//符号表
+    std::unordered_map<std::string, uint32_t> sym_index;
+    std::map<std::string, std::vector<ReplaceRecord>> files;
+};
+
+//混淆的范围, 范围越小需要的分析越少
+enum ObfuscateLevel {
+    LEVEL_CLASSES = 0,//只替换类名
+    LEVEL_DECLARATIONS,//类名, 全局/局部函数和它们的调用, 不推导主语类型, 不替换成员函数
+    LEVEL_FULL,//类名, 成员函数, 全局/局部函数和所有的调用
+};
 
 class Obfuscator {
 public:
     Obfuscator();
     ~Obfuscator();
 
-    void add_lex(const std::string& file_name, const std::string& file_path, Lex* lex, Reader* reader);
+    //out_path不为空时结果写到out_path, 不修改原文件
+    void add_lex(const std::string& file_name, const std::string& file_path, Lex* lex, Reader* reader, const std::string& out_path = "");
     Lex* get_lex(const std::string& file_name);
     void set_ignore_class(const std::set<std::string>& c_name);
     void set_ignore_function(const std::set<std::string>& fn_name);
     void set_ignore_class_function(const std::map<std::string, std::set<std::string>>& c_fn_name);
+    void set_infer_budget(int budget);
+    void set_predefined_marco(const std::vector<Token>& marcos);
+    void set_hash(HashMode mode, const uint64_t key[2]);
+    void set_level(ObfuscateLevel level);
 
     //按顺序调用
     void remove_comments();
@@ -30,27 +61,42 @@ public:
     void extract_local_var_fn();
 
     void label_call();
-    void label_fn_as_parameter();
-    void replace_call(bool hash=false);
+    //不推导类型, 只标记没有主语的函数调用, declarations级别用
+    void label_free_call();
+    void collect_replace(ReplaceSet& replace_set);
+    void write_replace(ReplaceSet& replace_set, bool hash=false);
+    //dry run: 不修改文件, 输出debug_out/patch和每个名字, 每个文件的替换次数debug_out/replace_count
+    void write_patch(ReplaceSet& replace_set, bool hash, const std::string& debug_out);
+
+    //hash模式下持久化的名字映射, 已经分配过的名字在以后的运行里保持不变
+    int load_mapping_db(const std::string& f);
+    void save_mapping_db();
 
     void debug(const std::string& debug_out);
+    void write_version_script(const std::string& f, const std::set<std::string>& public_api);
 
 private:
     bool is_in_marco(const std::string& m);
     bool is_in_marco(const std::string& m, Token& val);
+    int eval_condition(const Token& t, const CondExpr::MacroLookup& lookup);
     bool is_in_class_struct(const std::string& name, bool& tm);
     bool is_3th_base(const std::string& name);
     bool is_in_typedef(const std::string& name);
     bool is_in_typedef(const std::string& name, Token& t_type);
     
     bool is_member_function(const std::string& c_name, const std::string& fn_name);
-    bool is_member_function(const std::string& c_name, const std::string& fn_name, Token& ret);
-    bool is_local_function(const std::string& file_name, const std::string& fn_name, Token& t_type);
-    bool is_global_function(const std::string& fn_name, Token& ret);
+    bool is_member_function(const std::string& c_name, const std::string& fn_name, TypeRef& ret);
+    bool is_local_function(const std::string& file_name, const std::string& fn_name, TypeRef& t_type);
+    bool is_global_function(const std::string& fn_name, TypeRef& ret);
+
+    bool is_member_variable(const std::string& c_name, const std::string& c_v_name, TypeRef& t_type);
+    bool is_global_variable(const std::string& v_name, TypeRef& t_type);
+    bool is_local_variable(const std::string& file_name, const std::string& v_name, TypeRef& t_type);
 
-    bool is_member_variable(const std::string& c_name, const std::string& c_v_name, Token& t_type);
-    bool is_global_variable(const std::string& v_name, Token& t_type);
-    bool is_local_variable(const std::string& file_name, const std::string& v_name, Token& t_type);
+    void extract_container(TokenStream& ts);
+    void combine_type_with_multi_and_rm_const(TokenStream& ts);
+    bool resolve_typedef(const std::string& name, std::map<std::string, int>& status);
+    void build_typedef_canonical();
 
     bool is_stl_container(const std::string& name);
     bool is_stl_container_ret_iterator(const std::string& name);
@@ -60,81 +106,120 @@ private:
     bool is_ignore_function(const std::string& fn_name);
     bool is_ignore_class_function(const std::string& c_name, const std::string& fn_name);
 
+    ScopeID get_scope(ScopeID father, const std::string& name, int type);
+    ScopeID enter_scope(ScopeID father, const std::string& name, int type);
+    bool update_scope(std::deque<Token>::iterator& t, const TokenStream& ts, ScopeID& cur_scope, bool anonymous);
+
     void extract_class(
         std::deque<Token>::iterator& t, 
         std::deque<Token>::iterator it_begin, 
         std::deque<Token>::iterator& it_end, 
-        Scope cur_scope, 
-        std::deque<Token>& ts,
+        ScopeID cur_scope, 
+        TokenStream& ts,
         bool is_template);
 
-    std::map<std::string, Token> get_template_class_type_paras(std::string c_name);
+    const std::map<std::string, TypeRef>& get_template_class_type_paras(const std::string& c_name);
 
     void extract_class_member(
         std::string c_name, 
         std::deque<Token>::iterator& t, 
         std::deque<Token>::iterator it_begin, 
         std::deque<Token>::iterator it_end, 
-        std::deque<Token>& ts, 
+        TokenStream& ts, 
         bool is_template);
 
-    std::map<std::string, Token> label_skip_paren(std::deque<Token>::iterator& t, const std::deque<Token>& ts);
-    Token get_auto_type(
+    std::map<std::string, TypeRef> label_skip_paren(std::deque<Token>::iterator& t, const TokenStream& ts);
+    TypeRef get_auto_type(
         std::deque<Token>::iterator t, 
         const std::deque<Token>::iterator t_start, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp);
     
-    Token recall_subjust_type(
+    TypeRef recall_typedef_type(const std::string& name);
+
+    void build_call_filter();
+    void build_fn_bodies();
+    bool may_call_in_module(std::deque<Token>::iterator t_begin, std::deque<Token>::iterator t_end);
+
+    bool match_local_decl(
+        std::deque<Token>::iterator t, 
+        const std::deque<Token>::iterator t_start, 
+        const std::string& v_name,
+        const std::string& class_name, 
+        const std::string& file_name, 
+        const std::map<std::string, TypeRef>& paras,
+        bool is_cpp,
+        TypeRef& ret);
+
+    const LocalDeclIndex& get_local_decls(std::deque<Token>::iterator t_start);
+
+    bool find_local_variable(
+        std::deque<Token>::iterator t, 
+        const std::deque<Token>::iterator t_start, 
+        const std::string& class_name, 
+        const std::string& file_name, 
+        const std::map<std::string, TypeRef>& paras,
+        bool is_cpp,
+        TypeRef& ret);
+
+    TypeRef recall_subjust_type(
         std::deque<Token>::iterator t, 
         const std::deque<Token>::iterator t_start, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp);
 
-    Token get_subject_type(
+    TypeRef resolve_subject_type(
         std::deque<Token>::iterator& t, 
         const std::deque<Token>::iterator t_start, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp);
 
-    Token get_close_subject_type(
+    TypeRef get_subject_type(
         std::deque<Token>::iterator& t, 
         const std::deque<Token>::iterator t_start, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
+        bool is_cpp);
+
+    TypeRef get_close_subject_type(
+        std::deque<Token>::iterator& t, 
+        const std::deque<Token>::iterator t_start, 
+        const std::string& class_name, 
+        const std::string& file_name, 
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp);
     
-    Token get_fn_ret_type(
+    TypeRef get_fn_ret_type(
         std::deque<Token>::iterator& t, 
         const std::deque<Token>::iterator t_start, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp);
     
     bool is_call_in_module(std::deque<Token>::iterator t, 
         const std::deque<Token>::iterator t_start,  
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp,
-        Token& fn_subject_type);
+        TypeRef& fn_subject_type);
 
     void label_call_in_fn(std::deque<Token>::iterator t, 
         const std::deque<Token>::iterator t_start,
         const std::deque<Token>::iterator t_end, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp, 
-        std::deque<Token>& ts);
+        TokenStream& ts);
         
     void parse_tempalte_para(
         std::deque<Token>::iterator t_begin, 
@@ -143,17 +228,23 @@ private:
         std::vector<std::string>& paras_list);
 
     bool check_deref(std::deque<Token>::iterator t, bool is_fn);
+    void prepare_replace(ReplaceSet& replace_set, bool hash, std::vector<std::string>& new_names, std::vector<uint64_t>& freq);
+    void rewrite_code(const std::string& code, const std::vector<ReplaceRecord>& to_be_replace, bool hash,
+        const std::vector<std::string>& new_names, std::string& out_code, SourceMap& smap, std::vector<bool>& used);
+    void hash_symbols(const std::vector<std::string>& syms, std::vector<std::string>& names);
+    void short_symbols(const std::vector<std::string>& syms, const std::vector<uint64_t>& freq, std::vector<std::string>& names);
 
     void label_fn_as_para_in_fn(std::deque<Token>::iterator t, 
         const std::deque<Token>::iterator t_start,
         const std::deque<Token>::iterator t_end, 
         const std::string& class_name, 
         const std::string& file_name, 
-        const std::map<std::string, Token>& paras,
+        const std::map<std::string, TypeRef>& paras,
         bool is_cpp);
 private:
     std::vector<std::string> _file_name;
     std::vector<std::string> _file_path;
+    std::vector<std::string> _out_path;//每个文件的输出路径, 和_file_path对应
     std::vector<Lex*> _lex;
     std::vector<Reader*> _readers;
 
@@ -162,7 +253,11 @@ private:
     std::map<std::string, std::set<std::string>> _ignore_c_fn_name;
     std::map<std::string, std::set<std::string>> _ignore_c_fn_name_ext;
 
-    std::vector<Token> _g_marco;//全局宏定义
+    std::vector<Scope> _scopes;//作用域树, 下标即ScopeID, 0是全局作用域
+    std::map<std::string, ScopeID> _scope_ids;//key: 作用域的全名
+
+    std::vector<Token> _predefined_marco;//宏配置预定义的宏
+    MarcoTable _g_marco;//全局宏定义
     std::map<std::string, ClassType> _g_class;//全局class struct
     std::map<std::string, std::map<std::string, ClassType>> _g_class_childs;//全局的子类
     std::map<std::string, std::map<std::string, ClassType>> _g_class_bases;//全局的父类
@@ -177,13 +272,29 @@ private:
 
     std::map<std::string, Function> _g_functions;//全局函数
     std::map<std::string, std::map<std::string, Function>> _local_functions;//cpp的局部函数
+    std::map<const Token*, LocalDeclIndex> _local_decls;//函数体{ -> 局部声明索引, 只在label阶段(不修改token流)使用
+    std::map<const Token*, std::unordered_map<int, TypeRef>> _subject_types;//函数体{ -> <主语位置, 主语类型>
+    std::map<const Token*, int> _infer_steps;//函数体{ -> 已经推导的主语数
+    int _infer_depth;//get_subject_type当前的嵌套深度
+    TokenStream* _label_ts;//label阶段当前文件的token流, 推导时的括号跳转查它的配对表
+    int _infer_budget;//每个函数体最多推导的主语数, 超过后剩余的主语都认为是未知类型
+    std::vector<std::vector<FnBody>> _fn_bodies;//每个文件的函数体, 和_lex对应
+    BloomFilter _call_names;//所有模块内函数/成员函数名, 用来跳过不可能有模块调用的函数体
 
     //typedef
+    TypePool _types;//所有分析出来的类型
+
     std::map<std::string, Token> _typedef_map;//key scope::name
+    std::map<std::string, Token> _typedef_canonical;//typedef展开后的规范类型(单个CPP_TYPE)
 
     //std::vector<Token> _g_typedefs;//typedef 类型, 仅仅将typedef之前的token记录下来
 
     std::map<std::string, std::string> _map_replace;//map to find token old value, just record hash
+    HashMode _hash_mode;//hash时新名字的生成方式
+    uint64_t _hash_key[2];//HASH_SIP的密钥
+    ObfuscateLevel _level;
+    std::unordered_map<std::string, std::string> _mapping_db;//以前的运行分配的名字<原名, 新名字>
+    std::string _mapping_db_path;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "source_map.h"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+static const std::string SOURCE_MAP_MAGIC = "L1M1";
+
+static inline void put_varint(uint64_t v, std::string& out) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static inline bool get_varint(const std::string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        const unsigned char c = (unsigned char)in[pos++];
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+SourceMap::SourceMap() {
+
+}
+
+SourceMap::~SourceMap() {
+
+}
+
+void SourceMap::clear() {
+    _segs.clear();
+}
+
+void SourceMap::add(uint32_t line, uint32_t col, uint32_t orig_col, bool name) {
+    _segs.push_back({line, col, orig_col, name});
+}
+
+size_t SourceMap::size() const {
+    return _segs.size();
+}
+
+void SourceMap::encode(std::string& out) const {
+    out = SOURCE_MAP_MAGIC;
+    put_varint(_segs.size(), out);
+    uint32_t line = 0;
+    uint32_t col = 0;
+    for (auto it = _segs.begin(); it != _segs.end(); ++it) {
+        if (it->line != line) {
+            col = 0;
+        }
+        put_varint(it->line - line, out);
+        put_varint(it->col - col, out);
+        put_varint(zigzag((int64_t)it->orig_col - (int64_t)it->col) << 1 | (it->name ? 1 : 0), out);
+        line = it->line;
+        col = it->col;
+    }
+}
+
+bool SourceMap::decode(const std::string& in) {
+    _segs.clear();
+    if (in.compare(0, SOURCE_MAP_MAGIC.size(), SOURCE_MAP_MAGIC) != 0) {
+        return false;
+    }
+    size_t pos = SOURCE_MAP_MAGIC.size();
+    uint64_t num = 0;
+    if (!get_varint(in, pos, num) || num > in.size()) {
+        return false;
+    }
+    _segs.reserve((size_t)num);
+    uint32_t line = 0;
+    uint32_t col = 0;
+    for (uint64_t i = 0; i < num; ++i) {
+        uint64_t d_line = 0, d_col = 0, v = 0;
+        if (!get_varint(in, pos, d_line) || !get_varint(in, pos, d_col) || !get_varint(in, pos, v)) {
+            _segs.clear();
+            return false;
+        }
+        if (d_line != 0) {
+            col = 0;
+        }
+        line += (uint32_t)d_line;
+        col += (uint32_t)d_col;
+        const int64_t orig_col = (int64_t)col + unzigzag(v >> 1);
+        _segs.push_back({line, col, (uint32_t)orig_col, (v & 1) != 0});
+    }
+    return true;
+}
+
+bool SourceMap::save(const std::string& f) const {
+    std::ofstream out(f, std::ios::out | std::ios::binary);
+    if (!out.is_open()) {
+        return false;
+    }
+    std::string buf;
+    encode(buf);
+    out.write(buf.data(), buf.size());
+    out.close();
+    return true;
+}
+
+bool SourceMap::load(const std::string& f) {
+    std::ifstream in(f, std::ios::in | std::ios::binary);
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    return decode(buf);
+}
+
+void SourceMap::lookup(uint32_t line, uint32_t col, uint32_t& orig_line, uint32_t& orig_col) const {
+    orig_line = line;
+    orig_col = col;
+    //最后一个不大于(line, col)的段
+    auto it = std::upper_bound(_segs.begin(), _segs.end(), std::make_pair(line, col),
+        [](const std::pair<uint32_t, uint32_t>& p, const Segment& s) {
+            return p.first != s.line ? p.first < s.line : p.second < s.col;
+        });
+    if (it == _segs.begin()) {
+        return;
+    }
+    --it;
+    if (it->line != line) {
+        return;
+    }
+    orig_col = it->name ? it->orig_col : it->orig_col + (col - it->col);
+}
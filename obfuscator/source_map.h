@@ -0,0 +1,41 @@
+#ifndef MY_SOURCE_MAP_H
+#define MY_SOURCE_MAP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//混淆后的文件到原文件的位置映射, 行列都从1开始
+//替换只改变名字的长度, 不改变行, 所以只在每个替换处记录一段:
+//新名字的起点映射到原名的起点, 新名字之后按原来的列偏移. 没有记录的行列不变
+//文件格式: "L1M1", 段数, 每段 行增量 列增量(同一行时相对上一段) zigzag(原列-新列)<<1|是否名字, 都是varint
+class SourceMap {
+public:
+    SourceMap();
+    ~SourceMap();
+
+    void clear();
+    //按位置从小到大添加
+    void add(uint32_t line, uint32_t col, uint32_t orig_col, bool name);
+    size_t size() const;
+
+    void encode(std::string& out) const;
+    bool decode(const std::string& in);
+    bool save(const std::string& f) const;
+    bool load(const std::string& f);
+
+    //混淆后的(line, col)对应的原位置, 二分查找O(log n)
+    void lookup(uint32_t line, uint32_t col, uint32_t& orig_line, uint32_t& orig_col) const;
+
+private:
+    struct Segment {
+        uint32_t line;
+        uint32_t col;
+        uint32_t orig_col;
+        bool name;//名字里的列都映射到原名的起点
+    };
+
+    std::vector<Segment> _segs;
+};
+
+#endif
@@ -0,0 +1,15 @@
+#include "widget.h"
+
+#define FAST_PATH 1
+
+#if 0
+#define SLOW_PATH 1
+#endif
+
+int Widget::size() const {
+#ifdef FAST_PATH
+    return 1;
+#else
+    return 2;
+#endif
+}
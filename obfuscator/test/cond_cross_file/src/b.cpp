@@ -0,0 +1,50 @@
+#include "widget.h"
+
+int fast(Widget* w) {
+#ifdef FAST_PATH
+    return 0;
+#else
+    return w->size();
+#endif
+}
+
+int slow(Widget* w) {
+#if defined(SLOW_PATH)
+    return 0;
+#else
+    return w->size();
+#endif
+}
+
+#define TMP 1
+#undef TMP
+
+int tmp(Widget* w) {
+#ifdef TMP
+    return w->size() + 1;
+#else
+    return w->size();
+#endif
+}
+
+#define LEVEL 2
+
+int level(Widget* w) {
+#if LEVEL > 1
+    return w->size();
+#else
+    return w->size() - 1;
+#endif
+}
+
+#ifdef EXTERNAL_OPTION
+#define MAYBE 1
+#endif
+
+int maybe(Widget* w) {
+#ifdef MAYBE
+    return w->size() * 2;
+#else
+    return w->size();
+#endif
+}
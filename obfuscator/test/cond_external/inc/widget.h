@@ -0,0 +1,9 @@
+#ifndef WIDGET_H
+#define WIDGET_H
+
+class Widget {
+public:
+    int size() const;
+};
+
+#endif
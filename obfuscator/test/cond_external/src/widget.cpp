@@ -0,0 +1,21 @@
+#include "widget.h"
+
+int Widget::size() const {
+    return 1;
+}
+
+int check(Widget* w) {
+    int n = 0;
+#ifdef _DEBUG
+    n += w->size();
+#endif
+#ifndef NDEBUG
+    n += w->size();
+#else
+    n -= w->size();
+#endif
+#if defined(__CUDACC__) || 0
+    n *= w->size();
+#endif
+    return n;
+}
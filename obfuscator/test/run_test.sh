@@ -0,0 +1,81 @@
+#!/bin/bash
+#用法: test/run_test.sh [l1所在目录], 默认是obfuscator目录
+#每个用例把test/<用例>拷贝到临时目录, 生成配置后运行l1, 再检查输出
+cd "$(dirname "$0")/.."
+BIN=$(cd "${1:-.}" && pwd)
+TEST=$(pwd)/test
+EXTERN_TYPE=$(pwd)/extern_type
+FAIL=0
+
+#准备用例的工作目录, 输出工作目录的路径
+prepare() {
+    local dir=$(mktemp -d)
+    cp -r "$TEST/$1" "$dir/proj"
+    mkdir -p "$dir/result"
+    echo "$dir/proj/inc" > "$dir/file_source"
+    echo "$dir/proj/src" >> "$dir/file_source"
+    touch "$dir/ignore_file" "$dir/ignore_class" "$dir/ignore_function" "$dir/ignore_class_function"
+    cp "$EXTERN_TYPE" "$dir/"
+    echo "$dir"
+}
+
+check() {
+    if [ "$2" != "$3" ]; then
+        echo "FAIL $1: expect $3, got $2"
+        FAIL=1
+    else
+        echo "ok   $1"
+    fi
+}
+
+#外部宏(_DEBUG, NDEBUG, __CUDACC__)的条件分支不能删掉, 分支里的调用也要替换
+test_cond_external() {
+    local dir=$(prepare cond_external)
+    (cd "$dir" && "$BIN/l1" > log.txt 2>&1)
+    local f="$dir/proj/src/widget.cpp"
+    check "cond_external: renamed calls" "$(grep -c 'w->size_replace()' "$f")" 4
+    check "cond_external: left calls" "$(grep -c 'w->size()' "$f")" 0
+    rm -rf "$dir"
+}
+
+#其他文件里的#define, 被#undef的宏, 不确定分支里的#define不能决定分支, 同一个文件前面确定的#define/#undef可以
+#删掉的分支原文保留, 里面的调用不替换
+test_cond_cross_file() {
+    local dir=$(prepare cond_cross_file)
+    (cd "$dir" && "$BIN/l1" > log.txt 2>&1)
+    local f="$dir/proj/src/b.cpp"
+    check "cond_cross_file: renamed calls" "$(grep -c 'return w->size_replace();' "$f")" 5
+    check "cond_cross_file: left calls" "$(grep -c 'return w->size();' "$f")" 0
+    check "cond_cross_file: #undef branch dropped" "$(grep -c 'w->size() + 1' "$f")" 1
+    check "cond_cross_file: #if branch dropped" "$(grep -c 'w->size() - 1' "$f")" 1
+    check "cond_cross_file: unsure #define kept" "$(grep -c 'w->size_replace() \* 2' "$f")" 1
+    rm -rf "$dir"
+}
+
+#l1map写出后再读回来, 替换名之后的位置要按原名的长度换算回去
+test_source_map() {
+    local dir=$(prepare cond_external)
+    (cd "$dir" && "$BIN/l1" > log.txt 2>&1)
+    local f="$dir/proj/src/widget.cpp"
+    local line=$(grep -n 'w->size_replace()' "$f" | head -1 | cut -d: -f1)
+    local col=$(sed -n "${line}p" "$f" | awk '{print index($0, "size_replace")}')
+    local got=$("$BIN/l1d" --map "$f.l1map" "$line:$((col+12))" "$line:$((col+5))" "$line:1" "1:1" | tr '\n' ' ')
+    check "source_map: lookup" "$got" "$line:$((col+4)) $line:$col $line:1 1:1 "
+    rm -rf "$dir"
+}
+
+#short模式的短名字和普通单词重名, l1d要拒绝这种映射
+test_deob_short() {
+    local dir=$(prepare cond_external)
+    (cd "$dir" && "$BIN/l1" hash short > log.txt 2>&1)
+    echo "size check" | "$BIN/l1d" "$dir/result/replace_map" > /dev/null 2>&1
+    check "deob_short: refuse short map" "$?" 255
+    rm -rf "$dir"
+}
+
+test_cond_external
+test_cond_cross_file
+test_source_map
+test_deob_short
+
+exit $FAIL
@@ -0,0 +1,109 @@
+#ifndef MY_TOKEN_PATTERN_H
+#define MY_TOKEN_PATTERN_H
+
+#include "common.h"
+
+//编译期展开的token模式匹配
+//  Pattern<Kw<KwNamespace>, Is<CPP_NAME>, Is<CPP_OPEN_BRACE>>::match(t, ts)
+//等价于逐个判断 t, t+1, t+2, 但只做一次越界检查, 类型判断是掩码测试
+
+//token类型集合的掩码(TokenType超过64个, 分成两段)
+template <int... Types> struct TypeMask;
+
+template <> struct TypeMask<> {
+    static const uint64_t lo = 0;
+    static const uint64_t hi = 0;
+};
+
+template <int T, int... Rest> struct TypeMask<T, Rest...> {
+    static const uint64_t lo = (T < 64 ? (uint64_t(1) << (T & 63)) : 0) | TypeMask<Rest...>::lo;
+    static const uint64_t hi = (T >= 64 ? (uint64_t(1) << (T & 63)) : 0) | TypeMask<Rest...>::hi;
+};
+
+template <typename Mask> inline bool in_type_mask(int type) {
+    return type < 64 ? ((Mask::lo >> type) & 1) != 0 : ((Mask::hi >> (type & 63)) & 1) != 0;
+}
+
+//类型是Types中的一个
+template <int... Types> struct Is {
+    static bool match(const Token& t) {
+        return in_type_mask<TypeMask<Types...>>(t.type);
+    }
+};
+
+//类型不是Types中的任何一个
+template <int... Types> struct Not {
+    static bool match(const Token& t) {
+        return !in_type_mask<TypeMask<Types...>>(t.type);
+    }
+};
+
+//任意token
+struct Any {
+    static bool match(const Token&) {
+        return true;
+    }
+};
+
+//关键字/固定名称, 先比较长度
+#define TOKEN_KEYWORD(name, str) \
+struct name { \
+    static const char* val() { return str; } \
+    static size_t len() { return sizeof(str)-1; } \
+};
+
+template <typename K> struct Kw {
+    static bool match(const Token& t) {
+        return t.val.size() == K::len() && 0 == t.val.compare(K::val());
+    }
+};
+
+//满足其中一个元素
+template <typename... Es> struct Either;
+
+template <> struct Either<> {
+    static bool match(const Token&) {
+        return false;
+    }
+};
+
+template <typename E, typename... Es> struct Either<E, Es...> {
+    static bool match(const Token& t) {
+        return E::match(t) || Either<Es...>::match(t);
+    }
+};
+
+//从t开始连续的token依次匹配Es
+template <typename... Es> struct Pattern;
+
+template <> struct Pattern<> {
+    static const int size = 0;
+
+    template <typename It> static bool match_at(It) {
+        return true;
+    }
+};
+
+template <typename E, typename... Es> struct Pattern<E, Es...> {
+    static const int size = 1 + Pattern<Es...>::size;
+
+    template <typename It> static bool match_at(It t) {
+        return E::match(*t) && Pattern<Es...>::match_at(t+1);
+    }
+
+    static bool match(std::deque<Token>::iterator t, std::deque<Token>::iterator t_end) {
+        return t_end - t >= size && match_at(t);
+    }
+
+    template <typename Ts> static bool match(std::deque<Token>::iterator t, const Ts& ts) {
+        return ts.end() - std::deque<Token>::const_iterator(t) >= size && match_at(t);
+    }
+};
+
+TOKEN_KEYWORD(KwNamespace, "namespace")
+TOKEN_KEYWORD(KwOperator, "operator")
+TOKEN_KEYWORD(KwIterator, "iterator")
+TOKEN_KEYWORD(KwConstIterator, "const_iterator")
+TOKEN_KEYWORD(KwThrow, "throw")
+
+#endif
@@ -0,0 +1,114 @@
+#include "type_pool.h"
+
+static inline std::string node_key(const TypeNode& node) {
+    std::string key;
+    key.reserve(node.val.size() + node.subject.size() + node.ts.size()*sizeof(TypeRef) + 8);
+    key += (char)node.type;
+    key += node.deref ? '1' : '0';
+    key += node.val;
+    key += '\0';
+    key += node.subject;
+    key += '\0';
+    key.append((const char*)node.ts.data(), node.ts.size()*sizeof(TypeRef));
+    return key;
+}
+
+TypePool::TypePool() {
+    //0 固定为CPP_OTHER
+    TypeNode other;
+    _nodes.push_back(other);
+    _index[node_key(other)] = TYPE_OTHER;
+}
+
+TypePool::~TypePool() {
+
+}
+
+TypeRef TypePool::intern(const Token& t) {
+    if (t.type == CPP_OTHER) {
+        return TYPE_OTHER;
+    }
+
+    TypeNode node;
+    node.type = t.type;
+    node.val = t.val;
+    node.subject = t.subject;
+    node.deref = t.deref;
+    node.ts.reserve(t.ts.size());
+    for (auto it = t.ts.begin(); it != t.ts.end(); ++it) {
+        node.ts.push_back(intern(*it));
+    }
+    return intern(node);
+}
+
+TypeRef TypePool::intern(const TypeNode& node) {
+    if (node.type == CPP_OTHER) {
+        return TYPE_OTHER;
+    }
+
+    const std::string key = node_key(node);
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+        return it->second;
+    }
+
+    const TypeRef ref = (TypeRef)_nodes.size();
+    _nodes.push_back(node);
+    _index[key] = ref;
+    return ref;
+}
+
+TypeRef TypePool::make(const std::string& val, const std::vector<TypeRef>& ts) {
+    TypeNode node;
+    node.type = CPP_TYPE;
+    node.val = val;
+    node.ts = ts;
+    return intern(node);
+}
+
+const TypeNode& TypePool::get(TypeRef ref) const {
+    assert(ref < _nodes.size());
+    return _nodes[ref];
+}
+
+const std::string& TypePool::val(TypeRef ref) const {
+    return get(ref).val;
+}
+
+TypeRef TypePool::child(TypeRef ref, size_t i) const {
+    const TypeNode& node = get(ref);
+    assert(i < node.ts.size());
+    return node.ts[i];
+}
+
+TypeRef TypePool::set_deref(TypeRef ref, bool deref) {
+    if (ref == TYPE_OTHER || get(ref).deref == deref) {
+        return ref;
+    }
+    TypeNode node = get(ref);
+    node.deref = deref;
+    return intern(node);
+}
+
+Token TypePool::to_token(TypeRef ref) const {
+    const TypeNode& node = get(ref);
+    Token t(node.type, node.val, -1);
+    t.subject = node.subject;
+    t.deref = node.deref;
+    for (auto it = node.ts.begin(); it != node.ts.end(); ++it) {
+        t.ts.push_back(to_token(*it));
+    }
+    return t;
+}
+
+void TypePool::print(TypeRef ref, std::ostream& out) const {
+    const TypeNode& node = get(ref);
+    out << node.val << " ";
+    for (auto it = node.ts.begin(); it != node.ts.end(); ++it) {
+        print(*it, out);
+    }
+}
+
+size_t TypePool::size() const {
+    return _nodes.size();
+}
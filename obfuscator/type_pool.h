@@ -0,0 +1,42 @@
+#ifndef MY_TYPE_POOL_H
+#define MY_TYPE_POOL_H
+
+#include "common.h"
+#include <unordered_map>
+
+//类型节点, 子类型(容器参数, * & 等)用TypeRef引用
+struct TypeNode {
+    TokenType type;
+    std::string val;
+    std::string subject;
+    bool deref;
+    std::vector<TypeRef> ts;
+
+    TypeNode():type(CPP_OTHER),deref(false) {}
+};
+
+//hash-consing的类型池, 每个不同的类型只保存一份
+class TypePool {
+public:
+    TypePool();
+    ~TypePool();
+
+    TypeRef intern(const Token& t);
+    TypeRef intern(const TypeNode& node);
+    TypeRef make(const std::string& val, const std::vector<TypeRef>& ts);
+
+    const TypeNode& get(TypeRef ref) const;
+    const std::string& val(TypeRef ref) const;
+    TypeRef child(TypeRef ref, size_t i) const;
+    TypeRef set_deref(TypeRef ref, bool deref);
+
+    Token to_token(TypeRef ref) const;
+    void print(TypeRef ref, std::ostream& out) const;
+    size_t size() const;
+
+private:
+    std::deque<TypeNode> _nodes;//deque保证get返回的引用在intern之后依然有效
+    std::unordered_map<std::string, TypeRef> _index;
+};
+
+#endif
@@ -3,6 +3,11 @@
 #include <iostream>
 #include "mbedtls/md5.h"
 #include <boost/filesystem.hpp>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/fs.h>
 
 namespace {
 void get_files(const std::string& root , const std::set<std::string>& postfix,
@@ -104,6 +109,76 @@ bool Util::is_direction(const std::string& path) {
     return boost::filesystem::is_directory(path);
 }
 
+void Util::make_parent_dir(const std::string& path) {
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(boost::filesystem::path(path).parent_path(), ec);
+}
+
+int Util::clone_file(const std::string& src, const std::string& dst, bool link) {
+    make_parent_dir(dst);
+    unlink(dst.c_str());
+
+    if (link && 0 == ::link(src.c_str(), dst.c_str())) {
+        return 0;
+    }
+
+    int fd_in = open(src.c_str(), O_RDONLY);
+    if (fd_in < 0) {
+        std::cerr << "open file failed: " << src << "\n";
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd_in, &st) != 0) {
+        close(fd_in);
+        return -1;
+    }
+    int fd_out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    if (fd_out < 0) {
+        std::cerr << "open file failed: " << dst << "\n";
+        close(fd_in);
+        return -1;
+    }
+
+    int ret = 0;
+#ifdef FICLONE
+    //同一个支持reflink的文件系统(btrfs, xfs)上共享数据块, 不拷贝
+    if (0 == ioctl(fd_out, FICLONE, fd_in)) {
+        close(fd_in);
+        close(fd_out);
+        return 0;
+    }
+#endif
+    off_t left = st.st_size;
+    //copy_file_range在内核里拷贝, 不支持时退化成读写
+    while (left > 0) {
+        ssize_t n = copy_file_range(fd_in, nullptr, fd_out, nullptr, (size_t)left, 0);
+        if (n <= 0) {
+            break;
+        }
+        left -= n;
+    }
+    if (left > 0) {
+        char buf[64*1024];
+        lseek(fd_in, st.st_size - left, SEEK_SET);
+        ssize_t n = 0;
+        while ((n = read(fd_in, buf, sizeof(buf))) > 0) {
+            if (write(fd_out, buf, n) != n) {
+                ret = -1;
+                break;
+            }
+        }
+        if (n < 0) {
+            ret = -1;
+        }
+    }
+    close(fd_in);
+    close(fd_out);
+    if (ret != 0) {
+        std::cerr << "copy file failed: " << src << " -> " << dst << "\n";
+    }
+    return ret;
+}
+
 std::string Util::hash(const std::string& data) {
     char hex_str[32];
     assert(!data.empty());
@@ -127,4 +202,119 @@ std::string Util::hash(const std::string& data) {
     }
 
     return std::string(hex_str, 32);
-}
\ No newline at end of file
+}
+
+static inline uint64_t rotl64(uint64_t x, int b) {
+    return (x << b) | (x >> (64 - b));
+}
+
+static inline void sip_round(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+    v0 += v1; v1 = rotl64(v1, 13); v1 ^= v0; v0 = rotl64(v0, 32);
+    v2 += v3; v3 = rotl64(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = rotl64(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = rotl64(v1, 17); v1 ^= v2; v2 = rotl64(v2, 32);
+}
+
+std::string Util::sip_hash(const std::string& data, const uint64_t key[2]) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+
+    const unsigned char* in = (const unsigned char*)data.data();
+    const size_t len = data.size();
+    const size_t end = len - (len % 8);
+    for (size_t i = 0; i < end; i += 8) {
+        uint64_t m = 0;
+        for (int k = 7; k >= 0; --k) {
+            m = (m << 8) | in[i+k];
+        }
+        v3 ^= m;
+        sip_round(v0, v1, v2, v3);
+        sip_round(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    uint64_t b = ((uint64_t)len) << 56;
+    for (size_t k = 0; k < len % 8; ++k) {
+        b |= ((uint64_t)in[end+k]) << (8*k);
+    }
+    v3 ^= b;
+    sip_round(v0, v1, v2, v3);
+    sip_round(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i) {
+        sip_round(v0, v1, v2, v3);
+    }
+    const uint64_t h = v0 ^ v1 ^ v2 ^ v3;
+
+    const char* digits = "0123456789abcdef";
+    char hex_str[16];
+    for (int i = 0; i < 16; ++i) {
+        hex_str[i] = digits[(h >> (60 - 4*i)) & 0x0f];
+    }
+    return std::string(hex_str, 16);
+}
+
+std::string Util::base62_name(uint64_t n) {
+    const char* alnum = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    //长度为len的名字有52*62^(len-1)个
+    uint64_t count = 52;
+    uint64_t tail = 1;//62^(len-1)
+    int len = 1;
+    while (n >= count) {
+        n -= count;
+        count *= 62;
+        tail *= 62;
+        ++len;
+    }
+    std::string name(len, 'a');
+    name[0] = alnum[n / tail];
+    n %= tail;
+    for (int i = len-1; i > 0; --i) {
+        name[i] = alnum[n % 62];
+        n /= 62;
+    }
+    return name;
+}
+
+BloomFilter::BloomFilter():_mask(0) {
+
+}
+
+void BloomFilter::reset(size_t expect_num) {
+    //每个名称16bit, 3个hash的误报率在0.3%左右
+    size_t bits = 64;
+    while (bits < expect_num*16) {
+        bits <<= 1;
+    }
+    _bits.assign(bits/64, 0);
+    _mask = bits-1;
+}
+
+void BloomFilter::add(const std::string& val) {
+    if (_bits.empty()) {
+        reset(1);
+    }
+    const uint64_t h = std::hash<std::string>()(val);
+    const uint64_t h2 = (h >> 32) | 1;
+    for (uint64_t i = 0; i < 3; ++i) {
+        const uint64_t b = (h + i*h2) & _mask;
+        _bits[b >> 6] |= uint64_t(1) << (b & 63);
+    }
+}
+
+bool BloomFilter::may_contain(const std::string& val) const {
+    if (_bits.empty()) {
+        return false;
+    }
+    const uint64_t h = std::hash<std::string>()(val);
+    const uint64_t h2 = (h >> 32) | 1;
+    for (uint64_t i = 0; i < 3; ++i) {
+        const uint64_t b = (h + i*h2) & _mask;
+        if (0 == (_bits[b >> 6] & (uint64_t(1) << (b & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
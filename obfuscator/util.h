@@ -4,6 +4,14 @@
 #include <string>
 #include <set>
 #include <vector>
+#include <cstdint>
+
+//混淆名使用的hash
+enum HashMode {
+    HASH_MD5 = 0,//MbedTLS MD5, 32个十六进制字符
+    HASH_SIP,//带密钥的SipHash-2-4, 16个十六进制字符
+    HASH_SHORT,//不是hash, 按出现次数从多到少分配最短的base-62名字
+};
 
 class Util {
 public:
@@ -15,7 +23,32 @@ public:
 
     static bool is_direction(const std::string& path);
 
+    //创建path所在的目录
+    static void make_parent_dir(const std::string& path);
+
+    //把src复制到dst, 目标已存在时先删除, 自动创建目录
+    //依次尝试 FICLONE(reflink), 硬链接(link为true时), copy_file_range, 读写拷贝
+    static int clone_file(const std::string& src, const std::string& dst, bool link);
+
     static std::string hash(const std::string& val);
+    //SipHash-2-4, key是128位密钥, 返回16个十六进制字符
+    static std::string sip_hash(const std::string& val, const uint64_t key[2]);
+    //第n个base-62标识符: a..Z, aa..Z9, ... 首字符只用字母
+    static std::string base62_name(uint64_t n);
+};
+
+//名称的bloom filter, 只会误报存在, 不会漏报
+class BloomFilter {
+public:
+    BloomFilter();
+
+    void reset(size_t expect_num);
+    void add(const std::string& val);
+    bool may_contain(const std::string& val) const;
+
+private:
+    std::vector<uint64_t> _bits;
+    size_t _mask;
 };
 
 #endif
\ No newline at end of file